@@ -0,0 +1,156 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Load generator for run_benchmark.sh. Like curl, it makes one HTTP/1.0
+ * request per connection, but all of them from one process with a thread per
+ * concurrent client, so latencies aren't dominated by process startup and
+ * sub-millisecond differences between socket profiles show up.
+ * Prints "<status> <seconds>" per request, the same as
+ * curl -w "%{http_code} %{time_total}\n", with status 000 for failures.
+ */
+
+#define BUFSIZE 65536
+
+typedef struct {
+    const struct addrinfo *server;
+    const char *host;
+    char **targets;
+    int n_targets;
+    int n_requests;
+    int fastopen;
+    int next;           // Index of the next request to make
+    int *statuses;
+    double *latencies;
+} bench_t;
+
+static double now_secs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Makes one request for 'target' and reads the whole response
+// Returns the HTTP status or 0 on error
+static int make_request(const bench_t *bench, const char *target) {
+    int fd = socket(bench->server->ai_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        return 0;
+    }
+    // With TCP_FASTOPEN_CONNECT the request rides on the SYN once the client
+    // holds a cookie from an earlier connection
+    int one = 1;
+    if (bench->fastopen
+        && setsockopt(fd, IPPROTO_TCP, TCP_FASTOPEN_CONNECT, &one, sizeof(one)) == -1) {
+        close(fd);
+        return 0;
+    }
+    char buf[BUFSIZE];
+    int len = snprintf(buf, sizeof(buf), "GET /%s HTTP/1.0\r\nHost: %s\r\n\r\n",
+                       target, bench->host);
+    int status = 0;
+    if (connect(fd, bench->server->ai_addr, bench->server->ai_addrlen) == 0
+        && send(fd, buf, len, MSG_NOSIGNAL) == len) {
+        ssize_t bytes_read = read(fd, buf, sizeof(buf) - 1);
+        if (bytes_read > 0) {
+            buf[bytes_read] = '\0';
+            if (sscanf(buf, "HTTP/1.%*d %d", &status) != 1) {
+                status = 0;
+            }
+        }
+        while (bytes_read > 0 || (bytes_read == -1 && errno == EINTR)) {
+            bytes_read = read(fd, buf, sizeof(buf));
+        }
+        if (bytes_read == -1) {
+            status = 0;
+        }
+    }
+    close(fd);
+    return status;
+}
+
+// Thread function: makes requests until all of them have been made
+static void *client_func(void *arg) {
+    bench_t *bench = arg;
+    int i;
+    while ((i = __atomic_fetch_add(&bench->next, 1, __ATOMIC_RELAXED)) < bench->n_requests) {
+        double start = now_secs();
+        bench->statuses[i] = make_request(bench, bench->targets[i % bench->n_targets]);
+        bench->latencies[i] = now_secs() - start;
+    }
+    return NULL;
+}
+
+int main(int argc, char **argv) {
+    bench_t bench = { .n_requests = 500 };
+    int concurrency = 10;
+    int opt;
+    while ((opt = getopt(argc, argv, "c:fn:")) != -1) {
+        switch (opt) {
+        case 'c':
+            concurrency = atoi(optarg);
+            break;
+        case 'f':
+            bench.fastopen = 1;
+            break;
+        case 'n':
+            bench.n_requests = atoi(optarg);
+            break;
+        default:
+            argc = -1;
+        }
+    }
+    if (argc - optind < 3 || concurrency < 1 || bench.n_requests < 1) {
+        printf("Usage: %s [-n <requests>] [-c <concurrency>] [-f] <host> <port> <target>...\n",
+               argv[0]);
+        return 1;
+    }
+    bench.host = argv[optind];
+    bench.targets = argv + optind + 2;
+    bench.n_targets = argc - optind - 2;
+
+    struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM };
+    struct addrinfo *server;
+    int result;
+    if ((result = getaddrinfo(bench.host, argv[optind + 1], &hints, &server)) != 0) {
+        fprintf(stderr, "getaddrinfo: %s\n", gai_strerror(result));
+        return 1;
+    }
+    bench.server = server;
+    bench.statuses = calloc(bench.n_requests, sizeof(int));
+    bench.latencies = calloc(bench.n_requests, sizeof(double));
+    pthread_t *threads = calloc(concurrency, sizeof(pthread_t));
+    if (bench.statuses == NULL || bench.latencies == NULL || threads == NULL) {
+        perror("calloc");
+        return 1;
+    }
+    int n_threads = 0;
+    for (; n_threads < concurrency; n_threads++) {
+        if ((result = pthread_create(threads + n_threads, NULL, client_func, &bench)) != 0) {
+            fprintf(stderr, "pthread_create: %s\n", strerror(result));
+            break;
+        }
+    }
+    for (int i = 0; i < n_threads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    for (int i = 0; i < bench.n_requests && n_threads > 0; i++) {
+        printf("%03d %.6f\n", bench.statuses[i], bench.latencies[i]);
+    }
+    free(threads);
+    free(bench.statuses);
+    free(bench.latencies);
+    freeaddrinfo(server);
+    return n_threads > 0 ? 0 : 1;
+}
@@ -1,11 +1,20 @@
 #define _GNU_SOURCE
 
 #include <dlfcn.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <pthread.h>
 #include <semaphore.h>
+#include <stdarg.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
 
 #define SERVER_FILE_PREFIX "server_files/"
 #define CONCURRENCY_DEGREE 5
@@ -22,8 +31,211 @@ static sem_t semaphore;
  * threads have made a call to (f)open().
  * This is a (probably inelegant) way to check if a program is really capable
  * of 'CONCURRENCY_DEGREE' threads of execution.
+ * The barrier can be turned off with FAULT_BARRIER=0.
  */
 
+/*
+ * On top of the barrier, open, read, pread, preadv2, write, sendfile, accept(4)
+ * and stat can be made slow or flaky for benchmarking. Every syscall is
+ * configured through the environment with the prefix FAULT_<SYSCALL>_ (e.g.
+ * FAULT_READ_):
+ *   DELAY_US       fixed delay in microseconds added before every call
+ *   DELAY_RAND_US  additional uniformly random delay in [0, DELAY_RAND_US)
+ *   SHORT          probability (0.0-1.0) of a short read/write/sendfile
+ *   EAGAIN         probability of failing with EAGAIN without doing anything
+ *   EINTR          probability of failing with EINTR without doing anything
+ * The server reads requests with read(), probes whether a file is in the page
+ * cache with preadv2(RWF_NOWAIT) and loads cold files on its disk threads with
+ * pread(). So FAULT_PREADV2_EAGAIN is the share of requests that find their
+ * file cold, and FAULT_PREAD_DELAY_* make the disk threads see a slow disk.
+ * FAULT_SEED seeds the random number generator and FAULT_REPORT=1 prints
+ * how many faults were injected when the process exits.
+ */
+
+typedef enum {
+    FAULT_OPEN,
+    FAULT_READ,
+    FAULT_PREAD,
+    FAULT_PREADV2,
+    FAULT_WRITE,
+    FAULT_SENDFILE,
+    FAULT_ACCEPT,
+    FAULT_STAT,
+    N_FAULT_SYSCALLS
+} fault_syscall_t;
+
+// Fault settings and injection counters for a single syscall
+typedef struct {
+    const char *name;
+    long delay_us;
+    long delay_rand_us;
+    double short_rate;
+    double eagain_rate;
+    double eintr_rate;
+    unsigned long n_delayed;
+    unsigned long n_short;
+    unsigned long n_eagain;
+    unsigned long n_eintr;
+} fault_config_t;
+
+static fault_config_t faults[N_FAULT_SYSCALLS] = {
+    [FAULT_OPEN] = { .name = "OPEN" },
+    [FAULT_READ] = { .name = "READ" },
+    [FAULT_PREAD] = { .name = "PREAD" },
+    [FAULT_PREADV2] = { .name = "PREADV2" },
+    [FAULT_WRITE] = { .name = "WRITE" },
+    [FAULT_SENDFILE] = { .name = "SENDFILE" },
+    [FAULT_ACCEPT] = { .name = "ACCEPT" },
+    [FAULT_STAT] = { .name = "STAT" },
+};
+
+static pthread_once_t faults_once = PTHREAD_ONCE_INIT;
+static int barrier_enabled = 1;
+static int report_enabled = 0;
+static unsigned int base_seed = 0;
+static __thread unsigned int thread_seed;
+static __thread int thread_seeded = 0;
+
+// Pointers to the real implementations, resolved once in init_faults()
+static int (*open_orig)(const char *pathname, int flags, ...);
+static FILE *(*fopen_orig)(const char *restrict path, const char *restrict mode);
+static ssize_t (*read_orig)(int fd, void *buf, size_t count);
+static ssize_t (*pread_orig)(int fd, void *buf, size_t count, off_t offset);
+static ssize_t (*preadv2_orig)(int fd, const struct iovec *iov, int iovcnt, off_t offset, int flags);
+static ssize_t (*write_orig)(int fd, const void *buf, size_t count);
+static ssize_t (*sendfile_orig)(int out_fd, int in_fd, off_t *offset, size_t count);
+static int (*accept_orig)(int sockfd, __SOCKADDR_ARG addr, socklen_t *restrict addrlen);
+static int (*accept4_orig)(int sockfd, __SOCKADDR_ARG addr, socklen_t *restrict addrlen, int flags);
+static int (*stat_orig)(const char *restrict pathname, struct stat *restrict statbuf);
+
+// Reads a numeric environment variable, returning 'fallback' if unset
+static double env_number(const char *name, double fallback) {
+    const char *value = getenv(name);
+    if (value == NULL || *value == '\0') {
+        return fallback;
+    }
+    return strtod(value, NULL);
+}
+
+// Looks up the next definition of 'symbol', exiting if it does not exist
+static void *resolve(const char *symbol) {
+    void *fn = dlsym(RTLD_NEXT, symbol);
+    char *error = dlerror();
+    if (error != NULL || fn == NULL) {
+        fprintf(stderr, "dlsym: %s\n", error != NULL ? error : symbol);
+        _exit(1);
+    }
+    return fn;
+}
+
+// Prints the number of injected faults per syscall
+static void report_faults(void) {
+    for (int i = 0; i < N_FAULT_SYSCALLS; i++) {
+        fault_config_t *fault = faults + i;
+        fprintf(stderr, "fault %-8s delayed=%lu short=%lu eagain=%lu eintr=%lu\n",
+                fault->name, fault->n_delayed, fault->n_short, fault->n_eagain,
+                fault->n_eintr);
+    }
+}
+
+// Parses the environment and resolves the real syscall wrappers
+static void init_faults(void) {
+    open_orig = resolve("open");
+    fopen_orig = resolve("fopen");
+    read_orig = resolve("read");
+    pread_orig = resolve("pread");
+    preadv2_orig = resolve("preadv2");
+    write_orig = resolve("write");
+    sendfile_orig = resolve("sendfile");
+    accept_orig = resolve("accept");
+    accept4_orig = resolve("accept4");
+    stat_orig = resolve("stat");
+
+    char name[64];
+    for (int i = 0; i < N_FAULT_SYSCALLS; i++) {
+        fault_config_t *fault = faults + i;
+        snprintf(name, sizeof(name), "FAULT_%s_DELAY_US", fault->name);
+        fault->delay_us = (long) env_number(name, 0);
+        snprintf(name, sizeof(name), "FAULT_%s_DELAY_RAND_US", fault->name);
+        fault->delay_rand_us = (long) env_number(name, 0);
+        snprintf(name, sizeof(name), "FAULT_%s_SHORT", fault->name);
+        fault->short_rate = env_number(name, 0);
+        snprintf(name, sizeof(name), "FAULT_%s_EAGAIN", fault->name);
+        fault->eagain_rate = env_number(name, 0);
+        snprintf(name, sizeof(name), "FAULT_%s_EINTR", fault->name);
+        fault->eintr_rate = env_number(name, 0);
+    }
+
+    barrier_enabled = env_number("FAULT_BARRIER", 1) != 0;
+    report_enabled = env_number("FAULT_REPORT", 0) != 0;
+    base_seed = (unsigned int) env_number("FAULT_SEED", (double) time(NULL));
+    if (report_enabled) {
+        atexit(report_faults);
+    }
+}
+
+static void ensure_faults_initialized(void) {
+    pthread_once(&faults_once, init_faults);
+}
+
+// Returns a uniformly distributed number in [0, 1) from a per-thread generator
+static double random_unit(void) {
+    if (!thread_seeded) {
+        thread_seed = base_seed ^ (unsigned int) pthread_self();
+        thread_seeded = 1;
+    }
+    return (double) rand_r(&thread_seed) / ((double) RAND_MAX + 1);
+}
+
+// Returns true with probability 'rate'
+static int roll(double rate) {
+    return rate > 0 && random_unit() < rate;
+}
+
+// Sleeps for the configured delay of 'fault', if any
+static void inject_delay(fault_config_t *fault) {
+    long delay_us = fault->delay_us;
+    if (fault->delay_rand_us > 0) {
+        delay_us += (long) (random_unit() * fault->delay_rand_us);
+    }
+    if (delay_us <= 0) {
+        return;
+    }
+    __atomic_fetch_add(&fault->n_delayed, 1, __ATOMIC_RELAXED);
+    struct timespec ts = { delay_us / 1000000, (delay_us % 1000000) * 1000 };
+    while (nanosleep(&ts, &ts) == -1 && errno == EINTR) {
+    }
+}
+
+// Applies delay and error faults for one call of syscall 'which'
+// Returns 0 if the call should go ahead or -1 (with errno set) if it should fail
+static int inject_fault(fault_syscall_t which) {
+    ensure_faults_initialized();
+    fault_config_t *fault = faults + which;
+    inject_delay(fault);
+    if (roll(fault->eintr_rate)) {
+        __atomic_fetch_add(&fault->n_eintr, 1, __ATOMIC_RELAXED);
+        errno = EINTR;
+        return -1;
+    }
+    if (roll(fault->eagain_rate)) {
+        __atomic_fetch_add(&fault->n_eagain, 1, __ATOMIC_RELAXED);
+        errno = EAGAIN;
+        return -1;
+    }
+    return 0;
+}
+
+// Possibly shortens a transfer of 'count' bytes to between 1 and count - 1
+static size_t inject_short(fault_syscall_t which, size_t count) {
+    fault_config_t *fault = faults + which;
+    if (count <= 1 || !roll(fault->short_rate)) {
+        return count;
+    }
+    __atomic_fetch_add(&fault->n_short, 1, __ATOMIC_RELAXED);
+    return 1 + (size_t) (random_unit() * (count - 1));
+}
+
 // Initializes the semaphore if not initialized already
 // Returns 0 on success, -1 on failure
 int init_semaphore(void) {
@@ -92,22 +304,28 @@ int barrier(void) {
 }
 
 int open(const char *pathname, int flags, ...) {
-    // Init the semaphore if it hasn't already been initialized
-    if (init_semaphore() != 0) {
-        return -1;
+    // Pick up the mode argument, which is only passed when creating a file.
+    // O_TMPFILE includes the O_DIRECTORY bit, so it must match in full.
+    mode_t mode = 0;
+    if ((flags & O_CREAT) || (flags & O_TMPFILE) == O_TMPFILE) {
+        va_list ap;
+        va_start(ap, flags);
+        mode = va_arg(ap, mode_t);
+        va_end(ap);
     }
 
-    int (*open_orig)(const char *pathname, int flags);
-    open_orig = dlsym(RTLD_NEXT, "open"); // Get pointer to real open
-    char *error = dlerror();
-    if (error != NULL) {
-        fprintf(stderr, "dlsym: %s\n", error);
+    if (inject_fault(FAULT_OPEN) != 0) {
         return -1;
     }
 
     // If thread isn't opening a server file, let it proceed
-    if (!is_server_file(pathname)) {
-        return open_orig(pathname, flags);
+    if (!barrier_enabled || !is_server_file(pathname)) {
+        return open_orig(pathname, flags, mode);
+    }
+
+    // Init the semaphore if it hasn't already been initialized
+    if (init_semaphore() != 0) {
+        return -1;
     }
 
     // Otherwise, check in at the barrier
@@ -116,28 +334,24 @@ int open(const char *pathname, int flags, ...) {
         return -1;
     }
 
-    return open_orig(pathname, flags);
+    return open_orig(pathname, flags, mode);
 }
 
 FILE *fopen(const char * restrict path, const char * restrict mode) {
-    // Init the semaphore if it hasn't already been initialized
-    if (init_semaphore() != 0) {
-        return NULL;
-    }
-
-    FILE* (*fopen_orig)(const char * restrict path, const char * restrict mode);
-    fopen_orig = dlsym(RTLD_NEXT, "fopen"); // Get pointer to real fopen
-    char *error = dlerror();
-    if (error != NULL) {
-        fprintf(stderr, "dlsym: %s\n", error);
+    if (inject_fault(FAULT_OPEN) != 0) {
         return NULL;
     }
 
     // If thread isn't opening a server file, let it proceed
-    if (!is_server_file(path)) {
+    if (!barrier_enabled || !is_server_file(path)) {
         return fopen_orig(path, mode);
     }
 
+    // Init the semaphore if it hasn't already been initialized
+    if (init_semaphore() != 0) {
+        return NULL;
+    }
+
     // Otherwise, check in at the barrier
     int barrier_checkin = barrier();
     if (barrier_checkin != 0) {
@@ -146,3 +360,59 @@ FILE *fopen(const char * restrict path, const char * restrict mode) {
 
     return fopen_orig(path, mode);
 }
+
+ssize_t read(int fd, void *buf, size_t count) {
+    if (inject_fault(FAULT_READ) != 0) {
+        return -1;
+    }
+    return read_orig(fd, buf, inject_short(FAULT_READ, count));
+}
+
+ssize_t pread(int fd, void *buf, size_t count, off_t offset) {
+    if (inject_fault(FAULT_PREAD) != 0) {
+        return -1;
+    }
+    return pread_orig(fd, buf, inject_short(FAULT_PREAD, count), offset);
+}
+
+ssize_t preadv2(int fd, const struct iovec *iov, int iovcnt, off_t offset, int flags) {
+    if (inject_fault(FAULT_PREADV2) != 0) {
+        return -1;
+    }
+    return preadv2_orig(fd, iov, iovcnt, offset, flags);
+}
+
+ssize_t write(int fd, const void *buf, size_t count) {
+    if (inject_fault(FAULT_WRITE) != 0) {
+        return -1;
+    }
+    return write_orig(fd, buf, inject_short(FAULT_WRITE, count));
+}
+
+ssize_t sendfile(int out_fd, int in_fd, off_t *offset, size_t count) {
+    if (inject_fault(FAULT_SENDFILE) != 0) {
+        return -1;
+    }
+    return sendfile_orig(out_fd, in_fd, offset, inject_short(FAULT_SENDFILE, count));
+}
+
+int accept(int sockfd, __SOCKADDR_ARG addr, socklen_t *restrict addrlen) {
+    if (inject_fault(FAULT_ACCEPT) != 0) {
+        return -1;
+    }
+    return accept_orig(sockfd, addr, addrlen);
+}
+
+int accept4(int sockfd, __SOCKADDR_ARG addr, socklen_t *restrict addrlen, int flags) {
+    if (inject_fault(FAULT_ACCEPT) != 0) {
+        return -1;
+    }
+    return accept4_orig(sockfd, addr, addrlen, flags);
+}
+
+int stat(const char *restrict pathname, struct stat *restrict statbuf) {
+    if (inject_fault(FAULT_STAT) != 0) {
+        return -1;
+    }
+    return stat_orig(pathname, statbuf);
+}
@@ -1,5 +1,7 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include "connection_queue.h"
 
 /*
@@ -16,6 +18,9 @@ int connection_queue_init(connection_queue_t *queue) {
     queue->write_idx = 0;
     int result;
     queue->shutdown = 0;
+    queue->resumed_length = 0;
+    queue->resumed_read_idx = 0;
+    queue->resumed_write_idx = 0;
     // Error check for all the init function calls
     if ((result = pthread_mutex_init(&queue->lock, NULL)) != 0) {
         fprintf(stderr, "pthread_mutex_init: %s\n", strerror(result));
@@ -31,6 +36,16 @@ int connection_queue_init(connection_queue_t *queue) {
         fprintf(stderr, "pthread_cond_init: %s\n", strerror(result));
         return -1;
     }
+    // Initializes resumed connections full condition
+    if ((result = pthread_cond_init(&queue->resume_full, NULL)) != 0) {
+        fprintf(stderr, "pthread_cond_init: %s\n", strerror(result));
+        return -1;
+    }
+    // Initializes the condition waited on while draining
+    if ((result = pthread_cond_init(&queue->drained, NULL)) != 0) {
+        fprintf(stderr, "pthread_cond_init: %s\n", strerror(result));
+        return -1;
+    }
     return 0;
 }
 
@@ -62,6 +77,7 @@ int connection_enqueue(connection_queue_t *queue, int connection_fd) {
     }
     // Critical Section: perform enqueue operations
     queue->client_fds[queue->write_idx] = connection_fd;
+    queue->enqueued_ns[queue->write_idx] = trace_now_ns();
     queue->length++;
     queue->write_idx = (queue->write_idx + 1) % 5;
     // Done, release the mutex lock and signal other threads
@@ -121,6 +137,109 @@ int connection_dequeue(connection_queue_t *queue) {
     return fd;
 }
 
+int connection_requeue(connection_queue_t *queue, const pending_request_t *request) {
+    int result;
+    // Lock the mutex before the critical section
+    if ((result = pthread_mutex_lock(&queue->lock)) != 0) {
+        fprintf(stderr, "pthread_mutex_lock: %s\n", strerror(result));
+        return -1;
+    }
+    // Put the threads to sleep if the resumed connections are full
+    while (queue->resumed_length == RESUME_CAPACITY && !queue->shutdown) {
+        if ((result = pthread_cond_wait(&queue->resume_full, &queue->lock)) != 0) {
+            fprintf(stderr, "pthread_cond_wait: %s\n", strerror(result));
+            return -1;
+        }
+    }
+    // Nobody will resume the connection once the server is shutdown
+    if (queue->shutdown) {
+        if ((result = pthread_mutex_unlock(&queue->lock)) != 0) {
+            fprintf(stderr, "pthread_mutex_unlock: %s\n", strerror(result));
+        }
+        return -1;
+    }
+    // Critical Section: perform enqueue operations
+    queue->resumed[queue->resumed_write_idx] = *request;
+    queue->resumed_length++;
+    queue->resumed_write_idx = (queue->resumed_write_idx + 1) % RESUME_CAPACITY;
+    // Done, release the mutex lock and signal other threads
+    if ((result = pthread_cond_signal(&queue->queue_empty)) != 0) {
+        fprintf(stderr, "pthread_cond_signal: %s\n", strerror(result));
+        return -1;
+    }
+    if ((result = pthread_mutex_unlock(&queue->lock)) != 0) {
+        fprintf(stderr, "pthread_mutex_unlock: %s\n", strerror(result));
+        return -1;
+    }
+    return 0;
+}
+
+int connection_dequeue_request(connection_queue_t *queue, pending_request_t *request) {
+    int result;
+    request->conn.fd = -1;
+    request->conn.ssl = NULL;
+    request->trace.last_ns = 0;
+    request->file_fd = -1;
+    request->resource_path = NULL;
+    // Lock the mutex before the critical section
+    if ((result = pthread_mutex_lock(&queue->lock)) != 0) {
+        fprintf(stderr, "pthread_mutex_lock: %s\n", strerror(result));
+        return -1;
+    }
+    // Put the threads to sleep while there is neither a new nor a resumed connection
+    while (queue->length == 0 && queue->resumed_length == 0 && !queue->shutdown) {
+        if ((result = pthread_cond_wait(&queue->queue_empty, &queue->lock)) != 0) {
+            fprintf(stderr, "pthread_cond_wait: %s\n", strerror(result));
+            return -1;
+        }
+    }
+    // Check if the server is shutdown
+    if (queue->shutdown) {
+        if ((result = pthread_cond_signal(&queue->queue_full)) != 0) {
+            fprintf(stderr, "pthread_cond_signal: %s\n", strerror(result));
+            return -1;
+        }
+        if ((result = pthread_mutex_unlock(&queue->lock)) != 0) {
+            fprintf(stderr, "pthread_mutex_unlock: %s\n", strerror(result));
+            return -1;
+        }
+        return -2;
+    }
+
+    // Critical Section: finish resumed connections before taking new ones
+    int fd;
+    pthread_cond_t *freed;
+    if (queue->resumed_length > 0) {
+        *request = queue->resumed[queue->resumed_read_idx];
+        fd = request->conn.fd;
+        queue->resumed_read_idx = (queue->resumed_read_idx + 1) % RESUME_CAPACITY;
+        queue->resumed_length--;
+        freed = &queue->resume_full;
+    } else {
+        fd = queue->client_fds[queue->read_idx];
+        request->conn.fd = fd;
+        request->trace.last_ns = queue->enqueued_ns[queue->read_idx];
+        queue->read_idx = (queue->read_idx + 1) % CAPACITY;
+        queue->length--;
+        freed = &queue->queue_full;
+    }
+    if (queue->length == 0 && queue->resumed_length == 0
+        && (result = pthread_cond_signal(&queue->drained)) != 0) {
+        fprintf(stderr, "pthread_cond_signal: %s\n", strerror(result));
+    }
+
+    // Release the mutex lock and signal other threads. The connection has been
+    // taken out of the queue by now, so it is returned even if that fails.
+    if ((result = pthread_cond_signal(freed)) != 0) {
+        fprintf(stderr, "pthread_cond_signal: %s\n", strerror(result));
+    }
+    if ((result = pthread_mutex_unlock(&queue->lock)) != 0) {
+        fprintf(stderr, "pthread_mutex_unlock: %s\n", strerror(result));
+    }
+
+    return fd;
+}
+
 int connection_queue_shutdown(connection_queue_t *queue) {
     int result = 0;
     queue->shutdown = 1;
@@ -133,12 +252,50 @@ int connection_queue_shutdown(connection_queue_t *queue) {
         fprintf(stderr, "pthread_cond_wait: %s\n", strerror(result));
         return -1;
     }
+    if ((result = pthread_cond_broadcast(&queue->resume_full)) != 0) {
+        fprintf(stderr, "pthread_cond_wait: %s\n", strerror(result));
+        return -1;
+    }
     
     return 0;
 }
 
+int connection_queue_drain(connection_queue_t *queue) {
+    int result;
+    if ((result = pthread_mutex_lock(&queue->lock)) != 0) {
+        fprintf(stderr, "pthread_mutex_lock: %s\n", strerror(result));
+        return -1;
+    }
+    // Wait for consumers to take every connection still in the queue
+    while ((queue->length > 0 || queue->resumed_length > 0) && !queue->shutdown) {
+        if ((result = pthread_cond_wait(&queue->drained, &queue->lock)) != 0) {
+            fprintf(stderr, "pthread_cond_wait: %s\n", strerror(result));
+            pthread_mutex_unlock(&queue->lock);
+            return -1;
+        }
+    }
+    if ((result = pthread_mutex_unlock(&queue->lock)) != 0) {
+        fprintf(stderr, "pthread_mutex_unlock: %s\n", strerror(result));
+        return -1;
+    }
+    return connection_queue_shutdown(queue);
+}
+
 int connection_queue_free(connection_queue_t *queue) {
     int result;
+    // Close connections that were never resumed
+    while (queue->resumed_length > 0) {
+        pending_request_t *request = queue->resumed + queue->resumed_read_idx;
+        if (http_conn_close(&request->conn) == -1) {
+            perror("close");
+        }
+        if (close(request->file_fd) == -1) {
+            perror("close");
+        }
+        free(request->resource_path);
+        queue->resumed_read_idx = (queue->resumed_read_idx + 1) % RESUME_CAPACITY;
+        queue->resumed_length--;
+    }
     // Destroy all the mutex locks and conditional variables
     if ((result = pthread_cond_destroy(&queue->queue_full)) != 0) {
         fprintf(stderr, "queue_full pthread_cond_destroy: %s\n", strerror(result));
@@ -148,6 +305,14 @@ int connection_queue_free(connection_queue_t *queue) {
         fprintf(stderr, "queue_empty pthread_cond_destroy: %s\n", strerror(result));
         return -1;
     }
+    if ((result = pthread_cond_destroy(&queue->resume_full)) != 0) {
+        fprintf(stderr, "resume_full pthread_cond_destroy: %s\n", strerror(result));
+        return -1;
+    }
+    if ((result = pthread_cond_destroy(&queue->drained)) != 0) {
+        fprintf(stderr, "drained pthread_cond_destroy: %s\n", strerror(result));
+        return -1;
+    }
    if ((result = pthread_mutex_destroy(&queue->lock)) != 0) {
         fprintf(stderr, "lock pthread_mutex_destroy: %s\n", strerror(result));
         return -1;
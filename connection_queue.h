@@ -3,20 +3,43 @@
 
 #include <pthread.h>
 
+#include "http.h"
+#include "trace.h"
+
 #define CAPACITY 5
+#define RESUME_CAPACITY 16
+
+// A connection whose request has been read but not yet answered
+typedef struct {
+    http_conn_t conn;
+    http_request_t request;
+    http_policy_t policy;   // Of the route the request matched
+    int file_fd;
+    char *resource_path;
+    request_trace_t trace;
+} pending_request_t;
 
 // Struct representing a thread-safe queue data structure
 // The queue stores file descriptors of active client TCP sockets
 typedef struct {
     int client_fds[CAPACITY];
+    uint64_t enqueued_ns[CAPACITY];   // For tracing how long connections wait
     int length;
     int read_idx;
     int write_idx;
     int shutdown;
+    // Connections whose request has already been read, handed back by the
+    // disk pool once the requested file is resident in the page cache
+    pending_request_t resumed[RESUME_CAPACITY];
+    int resumed_length;
+    int resumed_read_idx;
+    int resumed_write_idx;
     // TODO Add necessary thread synchronization primitives to this struct
     pthread_mutex_t lock;
     pthread_cond_t queue_full;
     pthread_cond_t queue_empty;
+    pthread_cond_t resume_full;
+    pthread_cond_t drained;     // Both rings have been emptied
 
 } connection_queue_t;
 
@@ -48,6 +71,30 @@ int connection_enqueue(connection_queue_t *queue, int connection_fd);
  */
 int connection_dequeue(connection_queue_t *queue);
 
+/*
+ * Hand a connection whose request has already been read back to the queue so
+ * that a consumer can finish responding to it. Resumed connections are
+ * dequeued before new ones. Blocks while 'RESUME_CAPACITY' connections are
+ * already waiting to be resumed.
+ * queue: A pointer to the connection_queue_t to add to
+ * request: The connection, copied into the queue, which takes ownership of its
+ *          descriptors and heap-allocated resource path
+ * Returns 0 on success or -1 on error
+ */
+int connection_requeue(connection_queue_t *queue, const pending_request_t *request);
+
+/*
+ * Like connection_dequeue(), but also removes connections handed back with
+ * connection_requeue(), which take priority over new connections.
+ * queue: A pointer to the connection_queue_t to remove from
+ * request: Filled in with the request passed to connection_requeue(), which the
+ *          caller now owns, or with a NULL resource_path for a new connection,
+ *          in which case trace.last_ns is set to when it was enqueued
+ * Returns the removed socket file descriptor on success, -2 once the queue has
+ * been shut down or -1 on error
+ */
+int connection_dequeue_request(connection_queue_t *queue, pending_request_t *request);
+
 /*
  * Cleanly shuts down the connection queue. All threads currently blocked on an
  * enqueue or dequeue operation are unblocked and an error is returned to them.
@@ -56,8 +103,18 @@ int connection_dequeue(connection_queue_t *queue);
  */
 int connection_queue_shutdown(connection_queue_t *queue);
 
+/*
+ * Shut down the connection queue once every connection in it has been
+ * dequeued, so that consumers finish all connections accepted so far. Nothing
+ * may be enqueued (or requeued) once this has been called.
+ * queue: A pointer to the connection_queue_t to drain and shut down
+ * Returns 0 on success or -1 on error
+ */
+int connection_queue_drain(connection_queue_t *queue);
+
 /*
  * Deallocates and cleans up any resources associated with a connection queue.
+ * Connections still waiting to be resumed are closed.
  * Returns 0 on success or -1 on error
  */
 int connection_queue_free(connection_queue_t *queue);
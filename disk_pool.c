@@ -0,0 +1,259 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "disk_pool.h"
+
+#define READ_CHUNK_SIZE 65536
+// Pages probed by disk_file_is_resident(), including the first and last
+#define RESIDENCY_PROBES 4
+
+int disk_file_is_resident(int file_fd) {
+    struct stat file;
+    if (fstat(file_fd, &file) == -1 || !S_ISREG(file.st_mode) || file.st_size == 0) {
+        return 1;
+    }
+    // Read a byte from a few pages spread over the file without waiting for
+    // the disk: a page that isn't cached fails with EAGAIN instead. Unlike
+    // mapping the file and asking mincore(), this costs no page table
+    // updates, which matters on a path every request takes.
+    for (int i = 0; i < RESIDENCY_PROBES; i++) {
+        char byte;
+        struct iovec iov = { &byte, 1 };
+        off_t offset = (file.st_size - 1) * i / (RESIDENCY_PROBES - 1);
+        if (preadv2(file_fd, &iov, 1, offset, RWF_NOWAIT) == -1) {
+            // Kernels and file systems without RWF_NOWAIT can't tell
+            return errno != EAGAIN;
+        }
+    }
+    return 1;
+}
+
+// Reads the whole file 'fd' so that its pages end up resident
+static void load_into_page_cache(int fd) {
+    // Start readahead of the whole file, then wait for it by reading through it
+    int result;
+    if ((result = posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED)) != 0) {
+        fprintf(stderr, "posix_fadvise: %s\n", strerror(result));
+    }
+    char buf[READ_CHUNK_SIZE];
+    off_t offset = 0;
+    ssize_t bytes_read;
+    while ((bytes_read = pread(fd, buf, READ_CHUNK_SIZE, offset)) > 0) {
+        offset += bytes_read;
+    }
+}
+
+// Disk thread: warms up the file of each job, then hands its connection back
+static void *disk_thread_func(void *arg) {
+    disk_pool_t *pool = (disk_pool_t *) arg;
+    int result;
+    while (1) {
+        if ((result = pthread_mutex_lock(&pool->lock)) != 0) {
+            fprintf(stderr, "pthread_mutex_lock: %s\n", strerror(result));
+            return NULL;
+        }
+        while (pool->length == 0 && !pool->shutdown) {
+            if ((result = pthread_cond_wait(&pool->jobs_empty, &pool->lock)) != 0) {
+                fprintf(stderr, "pthread_cond_wait: %s\n", strerror(result));
+                pthread_mutex_unlock(&pool->lock);
+                return NULL;
+            }
+        }
+        if (pool->shutdown) {
+            pthread_mutex_unlock(&pool->lock);
+            return NULL;
+        }
+        pending_request_t job = pool->jobs[pool->read_idx];
+        pool->read_idx = (pool->read_idx + 1) % DISK_QUEUE_CAPACITY;
+        pool->length--;
+        pool->busy++;
+        if ((result = pthread_mutex_unlock(&pool->lock)) != 0) {
+            fprintf(stderr, "pthread_mutex_unlock: %s\n", strerror(result));
+            return NULL;
+        }
+
+        load_into_page_cache(job.file_fd);
+        // Resume the connection on a network thread
+        if (connection_requeue(pool->queue, &job) == -1) {
+            if (http_conn_close(&job.conn) == -1) {
+                perror("close");
+            }
+            if (close(job.file_fd) == -1) {
+                perror("close");
+            }
+            free(job.resource_path);
+        }
+
+        // Let a drain waiting on this job know it has been handed back
+        if ((result = pthread_mutex_lock(&pool->lock)) != 0) {
+            fprintf(stderr, "pthread_mutex_lock: %s\n", strerror(result));
+            return NULL;
+        }
+        pool->busy--;
+        if (pool->length == 0 && pool->busy == 0
+            && (result = pthread_cond_broadcast(&pool->jobs_done)) != 0) {
+            fprintf(stderr, "pthread_cond_broadcast: %s\n", strerror(result));
+        }
+        if ((result = pthread_mutex_unlock(&pool->lock)) != 0) {
+            fprintf(stderr, "pthread_mutex_unlock: %s\n", strerror(result));
+            return NULL;
+        }
+    }
+}
+
+int disk_pool_init(disk_pool_t *pool, connection_queue_t *queue) {
+    pool->length = 0;
+    pool->read_idx = 0;
+    pool->write_idx = 0;
+    pool->shutdown = 0;
+    pool->draining = 0;
+    pool->busy = 0;
+    pool->queue = queue;
+    int result;
+    if ((result = pthread_mutex_init(&pool->lock, NULL)) != 0) {
+        fprintf(stderr, "pthread_mutex_init: %s\n", strerror(result));
+        return -1;
+    }
+    if ((result = pthread_cond_init(&pool->jobs_empty, NULL)) != 0) {
+        fprintf(stderr, "pthread_cond_init: %s\n", strerror(result));
+        return -1;
+    }
+    if ((result = pthread_cond_init(&pool->jobs_done, NULL)) != 0) {
+        fprintf(stderr, "pthread_cond_init: %s\n", strerror(result));
+        return -1;
+    }
+    for (int i = 0; i < N_DISK_THREADS; i++) {
+        if ((result = pthread_create(pool->threads + i, NULL, disk_thread_func, pool)) != 0) {
+            fprintf(stderr, "pthread_create: %s\n", strerror(result));
+            // Stop the threads that were already started
+            pool->shutdown = 1;
+            pthread_cond_broadcast(&pool->jobs_empty);
+            for (int j = 0; j < i; j++) {
+                pthread_join(pool->threads[j], NULL);
+            }
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int disk_pool_submit(disk_pool_t *pool, const pending_request_t *request) {
+    int result;
+    if ((result = pthread_mutex_lock(&pool->lock)) != 0) {
+        fprintf(stderr, "pthread_mutex_lock: %s\n", strerror(result));
+        return -1;
+    }
+    // Let the caller serve the request inline rather than wait for a slot
+    if (pool->length == DISK_QUEUE_CAPACITY || pool->shutdown || pool->draining) {
+        if ((result = pthread_mutex_unlock(&pool->lock)) != 0) {
+            fprintf(stderr, "pthread_mutex_unlock: %s\n", strerror(result));
+            return -1;
+        }
+        return 1;
+    }
+    char *path_copy = strdup(request->resource_path);
+    if (path_copy == NULL) {
+        perror("strdup");
+        pthread_mutex_unlock(&pool->lock);
+        return -1;
+    }
+    pool->jobs[pool->write_idx] = *request;
+    pool->jobs[pool->write_idx].resource_path = path_copy;
+    pool->write_idx = (pool->write_idx + 1) % DISK_QUEUE_CAPACITY;
+    pool->length++;
+    if ((result = pthread_cond_signal(&pool->jobs_empty)) != 0) {
+        fprintf(stderr, "pthread_cond_signal: %s\n", strerror(result));
+        pthread_mutex_unlock(&pool->lock);
+        return -1;
+    }
+    if ((result = pthread_mutex_unlock(&pool->lock)) != 0) {
+        fprintf(stderr, "pthread_mutex_unlock: %s\n", strerror(result));
+        return -1;
+    }
+    return 0;
+}
+
+int disk_pool_drain(disk_pool_t *pool) {
+    int result;
+    if ((result = pthread_mutex_lock(&pool->lock)) != 0) {
+        fprintf(stderr, "pthread_mutex_lock: %s\n", strerror(result));
+        return -1;
+    }
+    pool->draining = 1;
+    while ((pool->length > 0 || pool->busy > 0) && !pool->shutdown) {
+        if ((result = pthread_cond_wait(&pool->jobs_done, &pool->lock)) != 0) {
+            fprintf(stderr, "pthread_cond_wait: %s\n", strerror(result));
+            pthread_mutex_unlock(&pool->lock);
+            return -1;
+        }
+    }
+    if ((result = pthread_mutex_unlock(&pool->lock)) != 0) {
+        fprintf(stderr, "pthread_mutex_unlock: %s\n", strerror(result));
+        return -1;
+    }
+    return 0;
+}
+
+int disk_pool_shutdown(disk_pool_t *pool) {
+    int result;
+    if ((result = pthread_mutex_lock(&pool->lock)) != 0) {
+        fprintf(stderr, "pthread_mutex_lock: %s\n", strerror(result));
+        return -1;
+    }
+    pool->shutdown = 1;
+    if ((result = pthread_cond_broadcast(&pool->jobs_empty)) != 0) {
+        fprintf(stderr, "pthread_cond_broadcast: %s\n", strerror(result));
+        pthread_mutex_unlock(&pool->lock);
+        return -1;
+    }
+    if ((result = pthread_mutex_unlock(&pool->lock)) != 0) {
+        fprintf(stderr, "pthread_mutex_unlock: %s\n", strerror(result));
+        return -1;
+    }
+
+    int exit_code = 0;
+    for (int i = 0; i < N_DISK_THREADS; i++) {
+        if ((result = pthread_join(pool->threads[i], NULL)) != 0) {
+            fprintf(stderr, "pthread_join: %s\n", strerror(result));
+            exit_code = -1;
+        }
+    }
+
+    // Close connections whose jobs never ran
+    while (pool->length > 0) {
+        if (http_conn_close(&pool->jobs[pool->read_idx].conn) == -1) {
+            perror("close");
+        }
+        if (close(pool->jobs[pool->read_idx].file_fd) == -1) {
+            perror("close");
+        }
+        free(pool->jobs[pool->read_idx].resource_path);
+        pool->read_idx = (pool->read_idx + 1) % DISK_QUEUE_CAPACITY;
+        pool->length--;
+    }
+    return exit_code;
+}
+
+int disk_pool_free(disk_pool_t *pool) {
+    int result;
+    if ((result = pthread_cond_destroy(&pool->jobs_empty)) != 0) {
+        fprintf(stderr, "jobs_empty pthread_cond_destroy: %s\n", strerror(result));
+        return -1;
+    }
+    if ((result = pthread_cond_destroy(&pool->jobs_done)) != 0) {
+        fprintf(stderr, "jobs_done pthread_cond_destroy: %s\n", strerror(result));
+        return -1;
+    }
+    if ((result = pthread_mutex_destroy(&pool->lock)) != 0) {
+        fprintf(stderr, "lock pthread_mutex_destroy: %s\n", strerror(result));
+        return -1;
+    }
+    return 0;
+}
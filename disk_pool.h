@@ -0,0 +1,80 @@
+#ifndef DISK_POOL_H
+#define DISK_POOL_H
+
+#include <pthread.h>
+
+#include "connection_queue.h"
+
+#define DISK_QUEUE_CAPACITY 16
+#define N_DISK_THREADS 2
+
+// Struct representing a pool of threads that pull cold files into the page
+// cache so that network threads never block on disk reads
+typedef struct {
+    pending_request_t jobs[DISK_QUEUE_CAPACITY];
+    int length;
+    int read_idx;
+    int write_idx;
+    int shutdown;
+    int draining;       // Set by disk_pool_drain(): no new jobs are taken
+    int busy;           // Jobs taken by a disk thread but not yet handed back
+    pthread_mutex_t lock;
+    pthread_cond_t jobs_empty;
+    pthread_cond_t jobs_done;
+    pthread_t threads[N_DISK_THREADS];
+    connection_queue_t *queue;
+} disk_pool_t;
+
+/*
+ * Returns true if the open file 'file_fd' looks resident in the page cache,
+ * so that it can be sent without blocking on disk. Only a few pages spread
+ * over the file are probed. Files that cannot be inspected count as resident.
+ */
+int disk_file_is_resident(int file_fd);
+
+/*
+ * Initialize a disk pool and start its 'N_DISK_THREADS' threads.
+ * Once a job's file is resident, its connection is handed back to 'queue'
+ * with connection_requeue().
+ * pool: Pointer to disk_pool_t to be initialized
+ * queue: The connection queue that resumed connections are returned to
+ * Returns 0 on success or -1 on error
+ */
+int disk_pool_init(disk_pool_t *pool, connection_queue_t *queue);
+
+/*
+ * Hand a connection over to the disk pool. Never blocks: if the pool already
+ * has 'DISK_QUEUE_CAPACITY' jobs waiting, nothing is submitted and the caller
+ * should serve the request itself.
+ * On success the pool takes ownership of the connection and the file.
+ * pool: A pointer to the disk_pool_t to submit to
+ * request: The connection, its request and the open file to load; the
+ *          resource path is copied by the pool
+ * Returns 0 if submitted, 1 if the pool is full, draining or shut down, -1 on
+ * error
+ */
+int disk_pool_submit(disk_pool_t *pool, const pending_request_t *request);
+
+/*
+ * Stop taking new jobs and wait until every job already submitted has handed
+ * its connection back to the connection queue.
+ * pool: A pointer to the disk_pool_t to drain
+ * Returns 0 on success or -1 on error
+ */
+int disk_pool_drain(disk_pool_t *pool);
+
+/*
+ * Stops the disk pool and waits for its threads to exit. Connections of jobs
+ * that were never started are closed.
+ * pool: A pointer to the disk_pool_t to shut down
+ * Returns 0 on success or -1 on error
+ */
+int disk_pool_shutdown(disk_pool_t *pool);
+
+/*
+ * Deallocates and cleans up any resources associated with a disk pool.
+ * Returns 0 on success or -1 on error
+ */
+int disk_pool_free(disk_pool_t *pool);
+
+#endif // DISK_POOL_H
@@ -0,0 +1,48 @@
+#ifndef HANDLER_H
+#define HANDLER_H
+
+#include "http.h"
+
+/*
+ * ABI for handler plugins: shared objects that compute responses in-process.
+ * A plugin is loaded with dlopen() at startup (see plugin.h) and bound to
+ * routes. It exports 'handler_abi_version' and the three functions below, and
+ * writes responses with the http_response_*() functions of http.h, which the
+ * server exports to it.
+ */
+
+#define HANDLER_ABI_VERSION 1
+
+// What a handler is told about the request it answers
+typedef struct {
+    const http_request_t *request;
+    const char *path;   // Request target after the route's prefix, or ""
+    const char *dir;    // Directory of the route, or the server's directory
+} handler_request_t;
+
+// Must be defined as HANDLER_ABI_VERSION by the plugin
+extern const int handler_abi_version;
+
+/*
+ * Called once, before any request is handled.
+ * args: The arguments given for the plugin on the command line, or "". Only
+ *       valid during the call.
+ * state: Set to whatever the plugin wants passed to the other functions
+ * Returns 0 on success or -1 if the plugin can't be used
+ */
+int handler_init(const char *args, void **state);
+
+/*
+ * Answer one request through 'response', which has been initialized but not
+ * started. Called on worker threads, possibly for several requests at once.
+ * Returns 0 on success or -1 on error, in which case the server answers with
+ * a 500 if the response hasn't been started yet
+ */
+int handler_handle(void *state, const handler_request_t *request, http_response_t *response);
+
+/*
+ * Called once at shutdown, after the last request has been handled.
+ */
+void handler_teardown(void *state);
+
+#endif // HANDLER_H
@@ -1,13 +1,24 @@
 #include <assert.h>
+#include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <stdarg.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <sys/stat.h>
 #include <string.h>
+#include <strings.h>
+#include <sys/sendfile.h>
 #include <unistd.h>
+#include <zlib.h>
 #include "http.h"
+#include "tls.h"
+#include "trace.h"
 
 #define BUFSIZE 512
+#define GZIP_BUFSIZE 16384
+// Bodies smaller than this gain too little from gzip to be worth the CPU
+#define GZIP_MIN_SIZE 256
 
 const char *get_mime_type(const char *file_extension) {
     if (strcmp(".txt", file_extension) == 0) {
@@ -25,137 +36,557 @@ const char *get_mime_type(const char *file_extension) {
     return NULL;
 }
 
-int read_http_request(int fd, char *resource_name) {
-    // Declare a buffer to store read info
-    char buf[BUFSIZE];
-    // Validate content is a GET
-    char *get_str = "GET";
-    char mode_buf[4];
-    // Reads first four characters
-    if (read(fd, mode_buf, 4) < 0){
-        fprintf(stderr, "Improper read of first 4 bytes\n");
-        return 1;
+// Reads up to 'count' bytes from the connection, decrypting if it uses TLS
+// Returns the number of bytes read, 0 at end of stream or -1 on error
+static ssize_t conn_read(http_conn_t *conn, void *buf, size_t count) {
+    if (conn->ssl == NULL) {
+        return read(conn->fd, buf, count);
     }
-    mode_buf[3] = '\0';
-    // Checks if the first 4 characters are GET 
-    if (strcmp(mode_buf, get_str) != 0){
-        fprintf (stderr, "Wrong mode %s\n", mode_buf);
-        return 1;
+    int bytes_read = SSL_read(conn->ssl, buf, count);
+    if (bytes_read > 0) {
+        return bytes_read;
     }
-    int first_loop = 1;
-    int bytes_read = 0;
-    // Finds the resource name and reads the rest of the file
-    while ((bytes_read = read(fd, buf, BUFSIZE)) > 0){
-        // finds the resource name on first iteration
-        if (first_loop){
-            strcpy(resource_name, strtok(buf, " "));
-            first_loop--;
-        }
-        // End loop at end of content
-        if (bytes_read != BUFSIZE){
-            break;
+    return SSL_get_error(conn->ssl, bytes_read) == SSL_ERROR_ZERO_RETURN ? 0 : -1;
+}
+
+// Writes all 'count' bytes of 'buf' to the connection
+// Returns 0 on success or -1 on error
+static int conn_write_all(http_conn_t *conn, const void *buf, size_t count) {
+    const char *pos = buf;
+    while (count > 0) {
+        ssize_t bytes_written;
+        if (conn->ssl != NULL) {
+            bytes_written = SSL_write(conn->ssl, pos, count);
+            if (bytes_written <= 0) {
+                return -1;
+            }
+        } else if ((bytes_written = write(conn->fd, pos, count)) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
         }
+        pos += bytes_written;
+        count -= bytes_written;
     }
     return 0;
 }
 
-int write_http_response(int fd, const char *resource_path) {
-    // Declares buffers to store content to read and write
-    char line[BUFSIZE];
-    char temp[BUFSIZE];
-    struct stat file;
-    // copies resource path into temp
-    strcpy(temp, resource_path);
-    // tokenize the resource path using strtok
-    char* token = strtok(temp, ".");
-    token = strtok(NULL, ".");
-    token = token - 1;
-    token[0] = '.';
-    char *ending = "\r\n";
-    // If not found, write 404 Not Found
-    if(stat(resource_path, &file) == -1){
-        // Construct the response using snprintf
-        if (snprintf(line, BUFSIZE, "HTTP/1.0 404 Not Found\r\n") < 0){
-            printf("error snprintfing");
-            return 1;
+// Sends the first 'size' bytes of 'file_fd' to the connection. Uses sendfile()
+// for plaintext and kTLS connections so the body never passes through user
+// space, and falls back to reading and encrypting it here otherwise.
+// Returns 0 on success or -1 on error, including when the file turns out to
+// be shorter than 'size' because it was truncated after being opened
+static int conn_send_file(http_conn_t *conn, int file_fd, off_t size) {
+    off_t offset = 0;
+    if (conn->ssl == NULL) {
+        while (offset < size) {
+            ssize_t bytes_sent = sendfile(conn->fd, file_fd, &offset, size - offset);
+            if (bytes_sent == -1 && errno == EINTR) {
+                continue;
+            }
+            if (bytes_sent <= 0) {
+                errno = bytes_sent == 0 ? ENODATA : errno;
+                return -1;
+            }
         }
-        // Writes the response to the provided file descriptor
-        if(write(fd, line, strlen(line)) == -1){
-            return 1;
+        return 0;
+    }
+    if (tls_ktls_send_enabled(conn->ssl)) {
+        while (offset < size) {
+            ossl_ssize_t bytes_sent = SSL_sendfile(conn->ssl, file_fd, offset, size - offset, 0);
+            // Like sendfile(), this returns 0 once a truncated file runs out
+            if (bytes_sent <= 0) {
+                errno = bytes_sent == 0 ? ENODATA : errno;
+                return -1;
+            }
+            offset += bytes_sent;
         }
-        // Constructs the string of the file size content
-        if (snprintf(line, BUFSIZE, "Content-Length: %d\r\n", 0) < 0){
-            printf("error snprintfing");
-            return 1;
+        return 0;
+    }
+    char file_buf[BUFSIZE];
+    while (offset < size) {
+        size_t count = size - offset < BUFSIZE ? size - offset : BUFSIZE;
+        ssize_t bytes_read = pread(file_fd, file_buf, count, offset);
+        if (bytes_read == -1 && errno == EINTR) {
+            continue;
         }
-        // prints file size content
-        if(write(fd, line, strlen(line)) == -1){
-            return 1;
+        if (bytes_read <= 0) {
+            errno = bytes_read == 0 ? ENODATA : errno;
+            return -1;
         }
-        // prints the ending of the HTTP format
-        if(write(fd, ending, strlen(ending)) == -1){
-            return 1;
+        if (conn_write_all(conn, file_buf, bytes_read) == -1) {
+            return -1;
         }
+        offset += bytes_read;
+    }
+    return 0;
+}
+
+int http_conn_close(http_conn_t *conn) {
+    if (conn->ssl != NULL) {
+        SSL_shutdown(conn->ssl);
+        SSL_free(conn->ssl);
+        conn->ssl = NULL;
+    }
+    return close(conn->fd);
+}
+
+// Returns a pointer just past the blank line ending the header section in the
+// first 'len' bytes of 'buf', or NULL if it has not been received yet
+static char *find_headers_end(char *buf, size_t len) {
+    for (size_t i = 0; i + 1 < len; i++) {
+        if (buf[i] == '\n' && buf[i + 1] == '\n') {
+            return buf + i + 2;
+        }
+        if (buf[i] == '\n' && buf[i + 1] == '\r' && i + 2 < len && buf[i + 2] == '\n') {
+            return buf + i + 3;
+        }
+    }
+    return NULL;
+}
+
+// Returns true if 'token' looks like a method name (only upper case letters)
+static int is_method_token(const char *token) {
+    if (*token == '\0') {
         return 0;
     }
-    // If valid, write 200 OK
-    else{
-        int byte_write = 0;
-        // First Line (200 ok)
-        if (snprintf(line, BUFSIZE, "HTTP/1.0 200 OK\r\n") < 0){
-            fprintf(stderr,"error snprintfing");
-            return 1;
+    for (; *token != '\0'; token++) {
+        if (*token < 'A' || *token > 'Z') {
+            return 0;
         }
-        // Write first line to file descriptor
-        if((byte_write = write(fd, line, strlen(line))) == -1){
-            return 1;
+    }
+    return 1;
+}
+
+// Copies the value of a Host header, starting at 'value', into 'host' in
+// lower case and without the port
+// Returns 0 on success or -1 if the host name is malformed or too long
+static int parse_host(const char *value, char host[MAX_HOST_LEN + 1]) {
+    value += strspn(value, " \t");
+    size_t len = strcspn(value, " \t\r\n");
+    // IPv6 literals are bracketed and contain colons of their own
+    const char *port = value[0] == '[' ? memchr(value, ']', len) : memchr(value, ':', len);
+    if (value[0] == '[') {
+        if (port == NULL) {
+            return -1;
         }
-        // clear content of line, filling it with 0
-        memset(line, 0, byte_write);
-        // Second Line (Content Type:)
-        const char* type = get_mime_type(token);
-        if (snprintf(line, BUFSIZE, "Content-Type: %s\r\n", type) < 0){
-            printf("error snprintfing");
-            return 1;
+        port++;
+    }
+    if (port != NULL) {
+        len = port - value;
+    }
+    if (len > MAX_HOST_LEN) {
+        return -1;
+    }
+    for (size_t i = 0; i < len; i++) {
+        host[i] = tolower((unsigned char) value[i]);
+    }
+    host[len] = '\0';
+    return 0;
+}
+
+// Returns true if the Accept-Encoding header value at 'value' lists gzip
+// without ruling it out with a zero q-value
+static int accepts_gzip(const char *value) {
+    const char *end = value + strcspn(value, "\r\n");
+    while (value < end) {
+        value += strspn(value, " \t,");
+        size_t len = strcspn(value, ",\r\n");
+        if (strncasecmp(value, "gzip", 4) == 0 && strchr(" \t;,\r\n", value[4]) != NULL) {
+            const char *q = strstr(value, "q=");
+            return q == NULL || q >= value + len || strtod(q + 2, NULL) > 0;
         }
-        if((byte_write = write(fd, line, strlen(line))) == -1){
-            return 1;
+        value += len;
+    }
+    return 0;
+}
+
+int read_http_request(http_conn_t *conn, http_request_t *request) {
+    // Declare a buffer to store the request line and headers
+    char buf[MAX_REQUEST_SIZE + 1];
+    size_t len = 0;
+    char *headers_end = NULL;
+    // Read until the end of the headers or until the buffer is full
+    while (headers_end == NULL && len < MAX_REQUEST_SIZE) {
+        ssize_t bytes_read = conn_read(conn, buf + len, MAX_REQUEST_SIZE - len);
+        if (bytes_read <= 0) {
+            if (bytes_read == -1 && errno == EINTR) {
+                continue;
+            }
+            return -1;
         }
-        memset(line, 0, byte_write);
-        // Third Line (Content Length)
-        if (snprintf(line, BUFSIZE, "Content-Length: %d\r\n", (int)file.st_size) < 0){
-            printf("error snprintfing");
-            return 1;
+        // Only the newly read bytes (plus the two before them) can complete it
+        size_t scan_from = len > 2 ? len - 2 : 0;
+        len += bytes_read;
+        headers_end = find_headers_end(buf + scan_from, len - scan_from);
+    }
+    buf[len] = '\0';
+    TRACE_PHASE(trace_current(), request_recv);
+
+    char *line_end = memchr(buf, '\n', len);
+    if (headers_end == NULL) {
+        // A request line that doesn't fit is a URI that is too long
+        return line_end == NULL ? 414 : 413;
+    }
+    // The request is parsed as strings, which a NUL byte would cut short
+    if (memchr(buf, '\0', headers_end - buf) != NULL) {
+        return 400;
+    }
+    *line_end = '\0';
+
+    // Split the request line into method, target and version
+    char *save_ptr;
+    char *method = strtok_r(buf, " \r", &save_ptr);
+    char *target = strtok_r(NULL, " \r", &save_ptr);
+    char *version = strtok_r(NULL, " \r", &save_ptr);
+    if (method == NULL || target == NULL || version == NULL
+        || strtok_r(NULL, " \r", &save_ptr) != NULL) {
+        return 400;
+    }
+    if (strcmp(method, "GET") == 0) {
+        request->method = HTTP_GET;
+    } else if (strcmp(method, "HEAD") == 0) {
+        request->method = HTTP_HEAD;
+    } else {
+        return is_method_token(method) ? 405 : 400;
+    }
+    if (strcmp(version, "HTTP/1.0") == 0) {
+        request->version_minor = 0;
+    } else if (strcmp(version, "HTTP/1.1") == 0) {
+        request->version_minor = 1;
+    } else {
+        return 400;
+    }
+
+    // Drop the query string, then reject targets escaping the served directory
+    target[strcspn(target, "?#")] = '\0';
+    if (strlen(target) > MAX_TARGET_LEN) {
+        return 414;
+    }
+    if (target[0] != '/' || strstr(target, "/..") != NULL) {
+        return 400;
+    }
+    strcpy(request->resource_name, target);
+
+    request->host[0] = '\0';
+    request->accepts_gzip = 0;
+    char *header = line_end + 1;
+    while (header < headers_end) {
+        char *header_end = memchr(header, '\n', headers_end - header);
+        // GET and HEAD requests have no use for a body, so refuse to receive one
+        if (strncasecmp(header, "Content-Length:", 15) == 0 && strtol(header + 15, NULL, 10) > 0) {
+            return 413;
         }
-        if((byte_write = write(fd, line, strlen(line))) == -1){
-            return 1;
+        if (strncasecmp(header, "Transfer-Encoding:", 18) == 0) {
+            return 413;
+        }
+        if (strncasecmp(header, "Host:", 5) == 0 && parse_host(header + 5, request->host) == -1) {
+            return 400;
+        }
+        if (strncasecmp(header, "Accept-Encoding:", 16) == 0) {
+            request->accepts_gzip = accepts_gzip(header + 16);
+        }
+        if (header_end == NULL) {
+            break;
+        }
+        header = header_end + 1;
+    }
+    TRACE_PHASE(trace_current(), request_parse);
+    return 0;
+}
+
+const char *http_status_text(int status) {
+    switch (status) {
+    case 200: return "OK";
+    case 400: return "Bad Request";
+    case 404: return "Not Found";
+    case 405: return "Method Not Allowed";
+    case 413: return "Payload Too Large";
+    case 414: return "URI Too Long";
+    case 429: return "Too Many Requests";
+    case 500: return "Internal Server Error";
+    case 503: return "Service Unavailable";
+    default: return "Unknown";
+    }
+}
+
+void http_response_init(http_response_t *response, http_conn_t *conn,
+                        const http_request_t *request) {
+    response->conn = conn;
+    response->head_only = request != NULL && request->method == HTTP_HEAD;
+    response->version_minor = request != NULL ? request->version_minor : 0;
+    response->started = 0;
+    response->chunked = 0;
+    response->extra_headers_len = 0;
+}
+
+// Appends formatted text to 'headers', which holds 'len' of 'size' bytes
+// Returns 0 on success or -1 if the text doesn't fit
+static int append_vheader(char *headers, int size, int *len, const char *format, va_list args) {
+    int added = vsnprintf(headers + *len, size - *len, format, args);
+    if (added < 0 || added >= size - *len) {
+        fprintf(stderr, "response headers too long\n");
+        return -1;
+    }
+    *len += added;
+    return 0;
+}
+
+// Appends a formatted header line to 'headers', which holds 'len' bytes
+// Returns 0 on success or -1 if the headers don't fit into 'HEADERS_SIZE' bytes
+#define HEADERS_SIZE (BUFSIZE + MAX_EXTRA_HEADERS)
+static int append_header(char *headers, int *len, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    int result = append_vheader(headers, HEADERS_SIZE, len, format, args);
+    va_end(args);
+    return result;
+}
+
+int http_response_header(http_response_t *response, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    int result = append_vheader(response->extra_headers, MAX_EXTRA_HEADERS - 2,
+                                &response->extra_headers_len, format, args);
+    va_end(args);
+    if (result == -1) {
+        return -1;
+    }
+    memcpy(response->extra_headers + response->extra_headers_len, "\r\n", 2);
+    response->extra_headers_len += 2;
+    return 0;
+}
+
+int http_response_cache_headers(http_response_t *response, const http_policy_t *policy) {
+    if (policy->cache == 1) {
+        return http_response_header(response, "Cache-Control: public, max-age=%d", policy->max_age);
+    }
+    if (policy->cache == 0) {
+        return http_response_header(response, "Cache-Control: no-store");
+    }
+    return 0;
+}
+
+int http_response_start(http_response_t *response, int status,
+                        const char *content_type, off_t content_length) {
+    char headers[HEADERS_SIZE];
+    int len = 0;
+    if (append_header(headers, &len, "HTTP/1.%d %d %s\r\nConnection: close\r\n",
+                      response->version_minor, status, http_status_text(status)) == -1) {
+        return -1;
+    }
+    if (content_type != NULL
+        && append_header(headers, &len, "Content-Type: %s\r\n", content_type) == -1) {
+        return -1;
+    }
+    if (status == 405 && append_header(headers, &len, "Allow: GET, HEAD\r\n") == -1) {
+        return -1;
+    }
+    if (content_length >= 0) {
+        if (append_header(headers, &len, "Content-Length: %lld\r\n",
+                          (long long) content_length) == -1) {
+            return -1;
+        }
+    } else if (response->version_minor >= 1) {
+        // HTTP/1.0 clients don't understand chunks, so closing the connection
+        // is what ends the body for them
+        response->chunked = 1;
+        if (append_header(headers, &len, "Transfer-Encoding: chunked\r\n") == -1) {
+            return -1;
         }
-        memset(line, 0, byte_write);
-        // Separate between headers and body
-        if((byte_write = write(fd, ending, strlen(ending))) == -1){
+    }
+    if (append_header(headers, &len, "%.*s\r\n",
+                      response->extra_headers_len, response->extra_headers) == -1) {
+        return -1;
+    }
+    // From here on the client may have part of the head
+    response->started = 1;
+    return conn_write_all(response->conn, headers, len);
+}
+
+// Sends the size line that precedes a chunk of 'count' bytes
+static int write_chunk_header(http_response_t *response, size_t count) {
+    char chunk_header[32];
+    int len = snprintf(chunk_header, sizeof(chunk_header), "%zx\r\n", count);
+    return conn_write_all(response->conn, chunk_header, len);
+}
+
+int http_response_write(http_response_t *response, const void *buf, size_t count) {
+    if (response->head_only || count == 0) {
+        return 0;
+    }
+    if (!response->chunked) {
+        return conn_write_all(response->conn, buf, count);
+    }
+    if (write_chunk_header(response, count) == -1
+        || conn_write_all(response->conn, buf, count) == -1
+        || conn_write_all(response->conn, "\r\n", 2) == -1) {
+        return -1;
+    }
+    return 0;
+}
+
+int http_response_printf(http_response_t *response, const char *format, ...) {
+    char text[BUFSIZE];
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(text, BUFSIZE, format, args);
+    va_end(args);
+    if (len < 0) {
+        return -1;
+    }
+    if (len < BUFSIZE) {
+        return http_response_write(response, text, len);
+    }
+    // Too long for the stack buffer: format again into one that fits
+    char *long_text = malloc(len + 1);
+    if (long_text == NULL) {
+        perror("malloc");
+        return -1;
+    }
+    va_start(args, format);
+    vsnprintf(long_text, len + 1, format, args);
+    va_end(args);
+    int result = http_response_write(response, long_text, len);
+    free(long_text);
+    return result;
+}
+
+int http_response_sendfile(http_response_t *response, int file_fd, off_t size) {
+    if (response->head_only || size == 0) {
+        return 0;
+    }
+    if (!response->chunked) {
+        return conn_send_file(response->conn, file_fd, size);
+    }
+    if (write_chunk_header(response, size) == -1
+        || conn_send_file(response->conn, file_fd, size) == -1
+        || conn_write_all(response->conn, "\r\n", 2) == -1) {
+        return -1;
+    }
+    return 0;
+}
+
+int http_response_finish(http_response_t *response) {
+    if (response->chunked && !response->head_only) {
+        return conn_write_all(response->conn, "0\r\n\r\n", 5);
+    }
+    return 0;
+}
+
+int http_send_error(http_conn_t *conn, int status) {
+    char body[64];
+    int len = snprintf(body, sizeof(body), "%d %s\n", status, http_status_text(status));
+    http_response_t response;
+    http_response_init(&response, conn, NULL);
+    if (http_response_start(&response, status, "text/plain", len) == -1
+        || http_response_write(&response, body, len) == -1) {
+        return -1;
+    }
+    return 0;
+}
+
+// Streams the first 'size' bytes of 'file_fd' as the gzip-compressed body
+// Returns 0 on success or -1 on error
+static int send_gzip_body(http_response_t *response, int file_fd, off_t size) {
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    // 16 added to the window bits asks zlib for a gzip wrapper
+    if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8,
+                     Z_DEFAULT_STRATEGY) != Z_OK) {
+        fprintf(stderr, "deflateInit2 failed\n");
+        return -1;
+    }
+    unsigned char *in = malloc(GZIP_BUFSIZE);
+    unsigned char *out = malloc(GZIP_BUFSIZE);
+    int result = in != NULL && out != NULL ? 0 : -1;
+    off_t offset = 0;
+    int flush = Z_NO_FLUSH;
+    while (result == 0 && flush != Z_FINISH) {
+        ssize_t bytes_read = pread(file_fd, in, GZIP_BUFSIZE, offset);
+        if (bytes_read == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            result = -1;
+            break;
+        }
+        offset += bytes_read;
+        flush = bytes_read == 0 || offset >= size ? Z_FINISH : Z_NO_FLUSH;
+        stream.next_in = in;
+        stream.avail_in = bytes_read;
+        do {
+            stream.next_out = out;
+            stream.avail_out = GZIP_BUFSIZE;
+            deflate(&stream, flush);
+            if (http_response_write(response, out, GZIP_BUFSIZE - stream.avail_out) == -1) {
+                result = -1;
+                break;
+            }
+        } while (stream.avail_out == 0);
+    }
+    deflateEnd(&stream);
+    free(in);
+    free(out);
+    return result;
+}
+
+int write_http_response(http_conn_t *conn, const http_request_t *request,
+                        const http_policy_t *policy, const char *resource_path, int file_fd) {
+    struct stat file;
+    http_response_t response;
+    http_response_init(&response, conn, request);
+    // If not found (the caller could not open it), write 404 Not Found
+    int found = file_fd != -1 && fstat(file_fd, &file) == 0 && S_ISREG(file.st_mode);
+    TRACE_PHASE(trace_current(), stat);
+    if (!found) {
+        if (http_response_start(&response, 404, NULL, 0) == -1) {
             return 1;
         }
-        memset(line, 0, byte_write);
+        return 0;
+    }
+    // If valid, write 200 OK with the type picked by the file's extension
+    const char *extension = strrchr(resource_path, '.');
+    const char *type = NULL;
+    if (extension != NULL && strchr(extension, '/') == NULL) {
+        type = get_mime_type(extension);
+    }
+    if (type == NULL) {
+        type = "application/octet-stream";
     }
-    
-    // Open file to copy content from 
-    int file_fd = open(resource_path, O_RDONLY | O_CREAT);
-    if (file_fd == -1){
-        perror("could not open file");
+    if (policy != NULL && http_response_cache_headers(&response, policy) == -1) {
         return 1;
     }
-    // Variables required to copy file content
-    char file_buf[BUFSIZE];
-    int bytes_read;
-    // Loop to copy file content
-    while ((bytes_read = read(file_fd, file_buf, BUFSIZE)) > 0){
-        if (write(fd, file_buf, bytes_read) != bytes_read){
+    // Text compresses well; images and PDFs are compressed already
+    int compress = policy != NULL && policy->compress && strncmp(type, "text/", 5) == 0;
+    if (compress && http_response_header(&response, "Vary: Accept-Encoding") == -1) {
+        return 1;
+    }
+    if (compress && request->accepts_gzip && file.st_size >= GZIP_MIN_SIZE) {
+        // The compressed length is only known once it has been sent
+        if (http_response_header(&response, "Content-Encoding: gzip") == -1
+            || http_response_start(&response, 200, type, -1) == -1) {
+            return 1;
+        }
+        TRACE_PHASE(trace_current(), send_headers);
+        if ((!response.head_only && send_gzip_body(&response, file_fd, file.st_size) == -1)
+            || http_response_finish(&response) == -1) {
             perror("Writing file");
             return 1;
         }
+        TRACE_PHASE(trace_current(), send_body);
+        return 0;
+    }
+    if (http_response_start(&response, 200, type, file.st_size) == -1) {
+        return 1;
     }
-    if (close(file_fd) == -1){
-        perror("close");
+    TRACE_PHASE(trace_current(), send_headers);
+    // Copy the file content to the client
+    if (http_response_sendfile(&response, file_fd, file.st_size) == -1) {
+        perror("Writing file");
+        return 1;
     }
+    TRACE_PHASE(trace_current(), send_body);
     return 0;
 }
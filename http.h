@@ -1,8 +1,141 @@
 #ifndef HTTP_H
 #define HTTP_H
 
-int read_http_request(int fd, char *resource_name);
+#include <sys/types.h>
+#include <openssl/ssl.h>
 
-int write_http_response(int fd, const char *resource_path);
+#define MAX_REQUEST_SIZE 8192
+#define MAX_TARGET_LEN 255
+#define MAX_HOST_LEN 255
+#define MAX_EXTRA_HEADERS 512
+
+// A client connection, which is either plaintext or TLS
+typedef struct {
+    int fd;
+    SSL *ssl;   // NULL for plaintext connections
+} http_conn_t;
+
+typedef enum {
+    HTTP_GET,
+    HTTP_HEAD
+} http_method_t;
+
+// A parsed request line and the headers the server acts on
+typedef struct {
+    http_method_t method;
+    int version_minor;                      // 0 for HTTP/1.0, 1 for HTTP/1.1
+    char resource_name[MAX_TARGET_LEN + 1]; // Request target without query
+    char host[MAX_HOST_LEN + 1];            // Lower case Host without port, or ""
+    int accepts_gzip;                       // Accept-Encoding allows gzip
+} http_request_t;
+
+// How responses for a route are sent
+typedef struct {
+    int cache;      // 1: cacheable for 'max_age' seconds, 0: no-store, -1: no header
+    int max_age;
+    int compress;   // Gzip text bodies for clients that accept it
+} http_policy_t;
+
+// State of a response being written to a client. Bodies of unknown length are
+// sent with chunked transfer encoding (or, for HTTP/1.0 clients, delimited by
+// closing the connection) and HEAD responses never carry a body.
+typedef struct {
+    http_conn_t *conn;
+    int head_only;
+    int started;    // Sending the status line and headers has begun
+    int chunked;
+    int version_minor;
+    char extra_headers[MAX_EXTRA_HEADERS];  // Added with http_response_header()
+    int extra_headers_len;
+} http_response_t;
+
+/*
+ * Read and parse a request from a client.
+ * Only GET and HEAD requests without a body are accepted.
+ * conn: The client connection
+ * request: Filled in with the parsed request
+ * Returns 0 on success, -1 if the connection failed or was closed before a
+ * complete request arrived, or the HTTP status code to reject the request with
+ * (400, 405, 413 or 414)
+ */
+int read_http_request(http_conn_t *conn, http_request_t *request);
+
+/*
+ * Respond to 'request' with the file at 'resource_path', or with a 404 if
+ * 'file_fd' is -1 or not a regular file.
+ * policy: Caching and compression for the response, or NULL for neither
+ * file_fd: The open descriptor of the file, still owned by the caller
+ * Returns 0 on success or 1 on error
+ */
+int write_http_response(http_conn_t *conn, const http_request_t *request,
+                        const http_policy_t *policy, const char *resource_path, int file_fd);
+
+/*
+ * Send a complete error response with a short plain text body.
+ * Returns 0 on success or -1 on error
+ */
+int http_send_error(http_conn_t *conn, int status);
+
+// Returns the reason phrase for an HTTP status code
+const char *http_status_text(int status);
+
+/*
+ * Prepare to respond to 'request' on 'conn'. Nothing is sent yet.
+ */
+void http_response_init(http_response_t *response, http_conn_t *conn,
+                        const http_request_t *request);
+
+/*
+ * Add a header line, formatted like printf() without the trailing CRLF, to
+ * those sent by http_response_start().
+ * Returns 0 on success or -1 if the extra headers don't fit
+ */
+int http_response_header(http_response_t *response, const char *format, ...)
+    __attribute__((format(printf, 2, 3)));
+
+/*
+ * Add the Cache-Control header that 'policy' asks for, if any.
+ * Returns 0 on success or -1 if the extra headers don't fit
+ */
+int http_response_cache_headers(http_response_t *response, const http_policy_t *policy);
+
+/*
+ * Send the status line and headers. A 'content_length' of -1 means the body
+ * length is not known in advance and it will be streamed.
+ * content_type: Value of the Content-Type header, or NULL to omit it
+ * Returns 0 on success or -1 on error
+ */
+int http_response_start(http_response_t *response, int status,
+                        const char *content_type, off_t content_length);
+
+/*
+ * Send 'count' bytes of body, as one chunk if the body is being streamed.
+ * Returns 0 on success or -1 on error
+ */
+int http_response_write(http_response_t *response, const void *buf, size_t count);
+
+/*
+ * Format body text like printf() and send it with http_response_write().
+ * Returns 0 on success or -1 on error
+ */
+int http_response_printf(http_response_t *response, const char *format, ...)
+    __attribute__((format(printf, 2, 3)));
+
+/*
+ * Send the first 'size' bytes of 'file_fd' as (part of) the body, without
+ * copying them through user space where possible.
+ * Returns 0 on success or -1 on error
+ */
+int http_response_sendfile(http_response_t *response, int file_fd, off_t size);
+
+/*
+ * Complete the response, terminating a streamed body.
+ * Returns 0 on success or -1 on error
+ */
+int http_response_finish(http_response_t *response);
+
+// Shuts down TLS on the connection, if any, and closes its socket
+// Returns 0 on success or -1 on error
+int http_conn_close(http_conn_t *conn);
 
 #endif // HTTP_H
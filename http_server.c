@@ -1,28 +1,60 @@
+#define _GNU_SOURCE
+
 #include <errno.h>
+#include <fcntl.h>
 #include <netdb.h>
+#include <poll.h>
 #include <pthread.h>
 #include <signal.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <unistd.h>
 
 #include "connection_queue.h"
+#include "disk_pool.h"
 #include "http.h"
+#include "plugin.h"
+#include "rate_limit.h"
+#include "router.h"
+#include "socket_profile.h"
+#include "tls.h"
+#include "trace.h"
+#include "upgrade.h"
 
 #define BUFSIZE 512
-#define LISTEN_QUEUE_LEN 5
 #define N_THREADS 5
+#define REQUEST_TIMEOUT_SECS 10
 
 const char *serve_dir;
+const char *config_path;    // Virtual host configuration, or NULL
 int keep_going = 1;
+volatile sig_atomic_t report_stats = 0;
+volatile sig_atomic_t reload_config = 0;
+
+// Virtual hosts and routes, swapped out when the configuration is reloaded
+router_handle_t router;
+// Handler plugins, loaded once at startup
+plugin_t *plugins = NULL;
+
+// Per-client limits on new connections (enforced right after accept()) and on
+// requests (enforced once a request has been read)
+rate_limiter_t connection_limiter;
+rate_limiter_t request_limiter;
 
 // Information passed to consumer threads
 typedef struct {
     int idx;
     connection_queue_t *queue;
+    disk_pool_t *disk_pool;
+    SSL_CTX *tls_ctx;   // NULL unless serving HTTPS
+    rate_limiter_t *request_limiter;
+    router_handle_t *router;
+    const socket_profile_t *profile;
 } thread_args_t;
 
 // Signal handling function
@@ -30,60 +62,440 @@ void handle_sigint(int signo) {
     keep_going = 0;
 }
 
+// SIGUSR1 asks for the monitoring counters to be printed
+void handle_sigusr1(int signo) {
+    report_stats = 1;
+}
+
+// SIGHUP asks for the virtual host configuration to be reloaded
+void handle_sighup(int signo) {
+    reload_config = 1;
+}
+
+// Prints monitoring counters to stderr
+void print_stats(void) {
+    fprintf(stderr, "rejected connections: %lu\nrejected requests: %lu\n",
+            rate_limit_rejections(&connection_limiter), rate_limit_rejections(&request_limiter));
+}
+
+// Acts on SIGUSR1 and SIGHUP, if either has arrived since the last call
+void handle_requests_from_signals(void) {
+    if (report_stats) {
+        report_stats = 0;
+        print_stats();
+    }
+    if (reload_config) {
+        reload_config = 0;
+        // Keep serving with the old configuration if the new one is broken
+        router_t *new_router = router_load(config_path, serve_dir, plugins);
+        if (new_router == NULL) {
+            fprintf(stderr, "keeping previous configuration\n");
+            return;
+        }
+        router_replace(&router, new_router);
+        fprintf(stderr, "configuration reloaded\n");
+    }
+}
+
+// Lets a handler plugin answer 'request' on 'conn'
+// prefix_len: Length of the prefix of the route that bound the handler
+// dir: Directory of that route
+void run_handler(const plugin_t *handler, http_conn_t *conn, const pending_request_t *request,
+                 size_t prefix_len, const char *dir){
+    handler_request_t handler_request = {
+        .request = &request->request,
+        .path = request->request.resource_name + prefix_len,
+        .dir = dir,
+    };
+    http_response_t response;
+    http_response_init(&response, conn, &request->request);
+    if (http_response_cache_headers(&response, &request->policy) == -1
+        || handler->handle(handler->state, &handler_request, &response) == -1){
+        // The client can still be told that something went wrong if nothing
+        // has been sent yet
+        if (!response.started && http_send_error(conn, 500) == -1){
+            perror("write");
+        }
+    }
+}
+
 // Thread function 
 void *thread_func(void *arg){
     // MAIN SERVER LOOP
     thread_args_t* args = (thread_args_t *) arg;
     while (keep_going && !(args->queue->shutdown)){
         int client_fd;
-        // Dequeue client fds from the queue
-        if ((client_fd = connection_dequeue(args->queue)) == -1){
+        pending_request_t request;
+        // Dequeue client fds from the queue, resumed connections first
+        // A connection that was dequeued is answered even if the queue has
+        // been shut down since, which a drain does as soon as it is empty
+        if ((client_fd = connection_dequeue_request(args->queue, &request)) == -2){
+            break;
+        }
+        if (client_fd == -1){
             printf("Dequeue error");
             continue;
         }
-        // Check if the server is shutdown
-        if (args->queue->shutdown == 1){
-            break;
-        }
-        // Once connected to client, read from them using reaf_http_response
-        char res[BUFSIZE];
+        http_conn_t conn = request.conn;
         char new_res[BUFSIZE];
-        if (read_http_request(client_fd, res)){
-            perror("read");
-            close(client_fd);
-            break;
-        }
-        // Combine the requested resource to the directory
-        if (snprintf(new_res, BUFSIZE, "%s", serve_dir) < 0){
-            printf("error creating formatted string of file\n");
-            return NULL;
-        }
-        if(snprintf(new_res + strlen(serve_dir), BUFSIZE - strlen(serve_dir), "%s", res) < 0){
-            printf("error creating formatted string of file\n");
-            return NULL;
+        int file_fd;
+        request_trace_t *trace = &request.trace;
+        trace_set_current(trace);
+        if (request.resource_path != NULL){
+            // The request was already read and its file loaded by the disk pool
+            TRACE_PHASE(trace, disk_offload);
+            snprintf(new_res, BUFSIZE, "%s", request.resource_path);
+            free(request.resource_path);
+            file_fd = request.file_fd;
+        }
+        else{
+            trace_request_begin(trace, request.trace.last_ns);
+            if (socket_profile_apply_client(args->profile, client_fd) == -1){
+                fprintf(stderr, "could not apply socket profile\n");
+            }
+            // Don't let a client that stops sending hold on to this thread
+            struct timeval timeout = { REQUEST_TIMEOUT_SECS, 0 };
+            if (setsockopt(client_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) == -1){
+                perror("setsockopt");
+            }
+            // HTTPS listener: complete the TLS handshake before reading
+            if (args->tls_ctx != NULL && (conn.ssl = tls_accept(args->tls_ctx, client_fd)) == NULL){
+                close(client_fd);
+                continue;
+            }
+            if (conn.ssl != NULL){
+                TRACE_PHASE(trace, tls_handshake);
+            }
+            // Once connected to client, read from them using read_http_request
+            int status = read_http_request(&conn, &request.request);
+            if (status != 0){
+                // Reject bad requests right away; a client that went away
+                // doesn't get a response at all
+                if (status != -1 && http_send_error(&conn, status) == -1){
+                    perror("write");
+                }
+                http_conn_close(&conn);
+                TRACE_PHASE(trace, send_error);
+                continue;
+            }
+            // Clients over their request rate get a 429
+            struct sockaddr_storage client_addr;
+            socklen_t addr_len = sizeof(client_addr);
+            struct sockaddr *client = (struct sockaddr *) &client_addr;
+            if (getpeername(client_fd, client, &addr_len) == -1){
+                client = NULL;
+            }
+            if (!rate_limit_allow(args->request_limiter, client)){
+                http_send_error(&conn, 429);
+                http_conn_close(&conn);
+                continue;
+            }
+            // Pick the route for the virtual host and map the requested
+            // resource into its directory
+            router_t *current_router = router_acquire(args->router);
+            const plugin_t *handler = NULL;
+            size_t prefix_len;
+            const route_t *route = router_match(current_router, request.request.host,
+                                                request.request.resource_name, &prefix_len);
+            if (route == NULL){
+                status = 404;
+            }
+            else if (route->limiter != NULL && !rate_limit_allow(route->limiter, client)){
+                status = 429;
+            }
+            else if (route->handler != NULL){
+                // Handlers are told the route's directory rather than a file
+                handler = route->handler;
+                request.policy = route->policy;
+                snprintf(new_res, BUFSIZE, "%s", route->dir);
+            }
+            else if (route_path(route, request.request.resource_name, prefix_len, new_res, BUFSIZE) == -1){
+                status = 414;
+            }
+            else{
+                request.policy = route->policy;
+            }
+            router_release(args->router, current_router);
+            if (status != 0){
+                http_send_error(&conn, status);
+                http_conn_close(&conn);
+                continue;
+            }
+            // Computed responses are written by the plugin, on this thread
+            if (handler != NULL){
+                run_handler(handler, &conn, &request, prefix_len, new_res);
+                TRACE_PHASE(trace, handler);
+                if (http_conn_close(&conn) == -1){
+                    perror("close");
+                }
+                TRACE_PHASE(trace, close);
+                trace_set_current(NULL);
+                continue;
+            }
+            // A file that can't be opened gets a 404 response
+            file_fd = open(new_res, O_RDONLY);
+            // Don't block on disk for a file that isn't in the page cache: let
+            // the disk pool load it and pick the connection up again afterwards
+            int resident = file_fd == -1 || request.request.method == HTTP_HEAD
+                           || disk_file_is_resident(file_fd);
+            TRACE_PHASE(trace, open);
+            if (!resident){
+                request.conn = conn;
+                request.file_fd = file_fd;
+                request.resource_path = new_res;
+                int submitted = disk_pool_submit(args->disk_pool, &request);
+                if (submitted == 0){
+                    continue;
+                }
+                if (submitted == -1){
+                    printf("disk pool error\n");
+                }
+            }
         }
         // Write the response to the client
-        if (write_http_response(client_fd, new_res)){
+        if (write_http_response(&conn, &request.request, &request.policy, new_res, file_fd)){
             perror("write");
-            close(client_fd);
-            break;
         }
-        if (close(client_fd) == -1){
+        if (file_fd != -1 && close(file_fd) == -1){
             perror("close");
-            break;
         }
+        if (http_conn_close(&conn) == -1){
+            perror("close");
+        }
+        TRACE_PHASE(trace, close);
+        trace_set_current(NULL);
     }
     
     return NULL;
 }
 
+// Creates a TCP socket bound to 'port', with the socket profile's listener
+// options applied
+// Returns the socket or -1 on error
+int bind_listener(const char *port, const socket_profile_t *profile) {
+    // Setting up the TCP socket (elements for getaddrinfo)
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));   // Emptying the struct
+    hints.ai_family = AF_UNSPEC;        // Unspecified INET, IPv4 or IPv6
+    hints.ai_socktype = SOCK_STREAM;    // TCP socket
+    hints.ai_flags = AI_PASSIVE;        // Being a server
+    struct addrinfo *server;
+
+    // Calling getaddrinfo to get all necessary info regarding the server
+    int ret_val = getaddrinfo(NULL, port, &hints, &server);
+    if (ret_val != 0) {
+        fprintf(stderr, "getaddrinfo failed: %s\n", gai_strerror(ret_val));
+        return -1;
+    }
+    // Calling socket to create socket file descriptor
+    int sock_fd = socket(server->ai_family, server->ai_socktype, server->ai_protocol);
+    if (sock_fd == -1) {
+        perror("socket");
+        freeaddrinfo(server);
+        return -1;
+    }
+    // Apply the socket profile's listener options before binding
+    if (socket_profile_apply_listener(profile, sock_fd) == -1) {
+        fprintf(stderr, "socket profile error\n");
+        freeaddrinfo(server);
+        close(sock_fd);
+        return -1;
+    }
+    // Calling bind to reserve a specific port
+    if (bind(sock_fd, server->ai_addr, server->ai_addrlen) == -1) {
+        fprintf(stderr, "bind error\n");
+        freeaddrinfo(server);
+        close(sock_fd);
+        return -1;
+    }
+    // Freeing server address struct as it is no longer needed to set up the server
+    freeaddrinfo(server);
+    return sock_fd;
+}
+
+// Serializes the state a server taking over from this one should start with:
+// the clients tracked by the rate limiters and the TLS session ticket keys
+// Returns the heap-allocated snapshot or NULL on error
+char *save_warm_state(SSL_CTX *tls_ctx, size_t *len) {
+    size_t connection_len, request_len;
+    char *connection_state = rate_limit_save(&connection_limiter, &connection_len);
+    char *request_state = rate_limit_save(&request_limiter, &request_len);
+    unsigned char keys[TLS_TICKET_KEYS_LEN];
+    char have_keys = tls_ctx != NULL && tls_get_ticket_keys(tls_ctx, keys) == 0;
+    char *state = NULL;
+    if (connection_state != NULL && request_state != NULL) {
+        *len = connection_len + request_len + 1 + (have_keys ? TLS_TICKET_KEYS_LEN : 0);
+        if ((state = malloc(*len)) == NULL) {
+            perror("malloc");
+        }
+        else {
+            memcpy(state, connection_state, connection_len);
+            memcpy(state + connection_len, request_state, request_len);
+            state[connection_len + request_len] = have_keys;
+            if (have_keys) {
+                memcpy(state + connection_len + request_len + 1, keys, TLS_TICKET_KEYS_LEN);
+            }
+        }
+    }
+    OPENSSL_cleanse(keys, sizeof(keys));
+    free(connection_state);
+    free(request_state);
+    return state;
+}
+
+// Loads a snapshot taken with save_warm_state() by the server being upgraded
+// Returns 0 on success or -1 if the snapshot is malformed
+int restore_warm_state(SSL_CTX *tls_ctx, const char *state, size_t len) {
+    ssize_t used;
+    if ((used = rate_limit_restore(&connection_limiter, state, len)) == -1) {
+        return -1;
+    }
+    state += used;
+    len -= used;
+    if ((used = rate_limit_restore(&request_limiter, state, len)) == -1) {
+        return -1;
+    }
+    state += used;
+    len -= used;
+    if (len < 1 || (state[0] && len < 1 + TLS_TICKET_KEYS_LEN)) {
+        return -1;
+    }
+    // Keep resuming sessions from tickets the old server issued
+    if (state[0] && tls_ctx != NULL
+        && tls_set_ticket_keys(tls_ctx, (const unsigned char *) state + 1) == -1) {
+        return -1;
+    }
+    return 0;
+}
+
+// Accepts a new server on the upgrade socket and sends it the listener and a
+// snapshot of warm state
+// Returns the connection to the new server or -1 if the upgrade didn't start
+int start_upgrade(int upgrade_fd, int sock_fd, SSL_CTX *tls_ctx) {
+    int control_fd = accept4(upgrade_fd, NULL, NULL, SOCK_CLOEXEC);
+    if (control_fd == -1) {
+        if (errno != EINTR) {
+            perror("accept");
+        }
+        return -1;
+    }
+    size_t state_len;
+    char *state = save_warm_state(tls_ctx, &state_len);
+    int sent = state != NULL && upgrade_send(control_fd, &sock_fd, 1, state, state_len) == 0;
+    if (state != NULL) {
+        OPENSSL_cleanse(state, state_len);
+        free(state);
+    }
+    if (!sent) {
+        fprintf(stderr, "upgrade failed\n");
+        close(control_fd);
+        return -1;
+    }
+    return control_fd;
+}
+
 int main(int argc, char **argv) {
-    // First command is directory to serve, second command is port
-    if (argc != 3) {
-        printf("Usage: %s <directory> <port>\n", argv[0]);
+    // Options, then directory to serve and port
+    const char *cert_path = NULL;
+    const char *key_path = NULL;
+    const char *upgrade_path = NULL;
+    double connection_rate = 0, connection_burst = 1;
+    double request_rate = 0, request_burst = 1;
+    socket_profile_t profile;
+    socket_profile_default(&profile);
+    int opt;
+    while ((opt = getopt(argc, argv, "c:C:H:K:l:L:S:T:U:")) != -1) {
+        switch (opt) {
+        case 'c':
+            config_path = optarg;
+            break;
+        case 'C':
+            cert_path = optarg;
+            break;
+        case 'H':
+            if (plugin_load(&plugins, optarg) == -1) {
+                argc = -1;
+            }
+            break;
+        case 'K':
+            key_path = optarg;
+            break;
+        case 'l':
+            if (rate_limit_parse(optarg, &connection_rate, &connection_burst) == -1) {
+                argc = -1;
+            }
+            break;
+        case 'L':
+            if (rate_limit_parse(optarg, &request_rate, &request_burst) == -1) {
+                argc = -1;
+            }
+            break;
+        case 'S':
+            if (socket_profile_parse(&profile, optarg) == -1) {
+                argc = -1;
+            }
+            break;
+        case 'T':
+            if (trace_open_spec(optarg) == -1) {
+                argc = -1;
+            }
+            break;
+        case 'U':
+            upgrade_path = optarg;
+            break;
+        default:
+            argc = -1;
+        }
+    }
+    if (argc - optind != 2 || (cert_path == NULL) != (key_path == NULL)) {
+        printf("Usage: %s [-c <vhosts.conf>] [-C <cert.pem> -K <key.pem>] "
+               "[-H <name>=<plugin.so>[:<args>]] [-l <conns/s>[:<burst>]] "
+               "[-L <reqs/s>[:<burst>]] [-S <name>=<value>,...] "
+               "[-T <trace.json>[:<sample 1 in N>]] [-U <upgrade.sock>] <directory> <port>\n",
+               argv[0]);
+        return 1;
+    }
+    if (rate_limit_init(&connection_limiter, connection_rate, connection_burst) == -1
+        || rate_limit_init(&request_limiter, request_rate, request_burst) == -1) {
         return 1;
     }
 
+    // Requests for hosts the configuration doesn't name are served from the
+    // directory given on the command line
+    serve_dir = argv[optind];
+    router_t *initial_router = router_load(config_path, serve_dir, plugins);
+    if (initial_router == NULL) {
+        return 1;
+    }
+    if (router_handle_init(&router, initial_router) == -1) {
+        router_free(initial_router);
+        return 1;
+    }
+
+    // Serve HTTPS when given a certificate and key
+    SSL_CTX *tls_ctx = NULL;
+    if (cert_path != NULL && (tls_ctx = tls_server_init(cert_path, key_path)) == NULL) {
+        return 1;
+    }
+
+    // A server already listening for upgrades at the same path hands over
+    // its listener and warm state, then drains once this one is running
+    upgrade_handoff_t handoff;
+    int upgrading = upgrade_path != NULL ? upgrade_receive(upgrade_path, &handoff) : 0;
+    if (upgrading == -1) {
+        return 1;
+    }
+    if (upgrading) {
+        if (handoff.n_fds != 1) {
+            fprintf(stderr, "expected one listener from the old server, got %d\n", handoff.n_fds);
+            return 1;
+        }
+        if (restore_warm_state(tls_ctx, handoff.state, handoff.state_len) == -1) {
+            fprintf(stderr, "ignoring malformed state snapshot\n");
+        }
+        OPENSSL_cleanse(handoff.state, handoff.state_len);
+    }
+
     // Set up signal handler
     sigset_t init_set;
     if (sigfillset(&init_set) == -1 || sigaddset(&init_set, SIGINT) == -1){
@@ -107,50 +519,34 @@ int main(int argc, char **argv) {
     thread_args_t args[N_THREADS];
 
     // Uncomment the lines below to use these definitions:
-    serve_dir = argv[1];
-    const char *port = argv[2];
+    const char *port = argv[optind + 1];
 
-    // Setting up the TCP socket (elements for getaddrinfo)
-    struct addrinfo hints;
-    memset(&hints, 0, sizeof(hints));   // Emptying the struct
-    hints.ai_family = AF_UNSPEC;        // Unspecified INET, IPv4 or IPv6
-    hints.ai_socktype = SOCK_STREAM;    // TCP socket
-    hints.ai_flags = AI_PASSIVE;        // Being a server
-    struct addrinfo *server;
-
-    // Calling getaddrinfo to get all necessary info regarding the server
-    int ret_val = getaddrinfo(NULL, port, &hints, &server);
-    if (ret_val != 0) {
-        fprintf(stderr, "getaddrinfo failed: %s\n", gai_strerror(ret_val));
+    // Take over the listener of the server being upgraded, or bind a new one
+    int sock_fd = upgrading ? handoff.fds[0] : bind_listener(port, &profile);
+    if (sock_fd == -1 || (upgrading && socket_profile_apply_listener(&profile, sock_fd) == -1)) {
+        fprintf(stderr, "listener error\n");
         if (connection_queue_shutdown(&queue) == -1){
-            printf("shutdown error\n");
-            return 1;
+            fprintf(stderr, "shutdown error\n");
         }
         if (connection_queue_free(&queue) == -1){
             fprintf(stderr, "free error\n");
-            return 1;
         }
-        return 1;
-    }
-    // Calling socket to create socket file descriptor
-    int sock_fd = socket(server->ai_family, server->ai_socktype, server->ai_protocol);
-    if (sock_fd == -1) {
-        perror("socket");
-        if (connection_queue_shutdown(&queue) == -1){
-            printf("shutdown error\n");
-            return 1;
-        }
-        if (connection_queue_free(&queue) == -1){
-            fprintf(stderr, "free error\n");
-            return 1;
+        if (sock_fd != -1 && close(sock_fd) == -1){
+            perror("close");
         }
         return 1;
     }
-    // Calling bind to reserve a specific port
-    if (bind(sock_fd, server->ai_addr, server->ai_addrlen) == -1) {
-        fprintf(stderr, "bind error\n");
+    // Upgrade requests are watched alongside the listener, so accepting from
+    // it must never block
+    if (upgrade_path != NULL && fcntl(sock_fd, F_SETFL, fcntl(sock_fd, F_GETFL) | O_NONBLOCK) == -1){
+        perror("fcntl");
+    }
+
+    // Calling listen to designate sock_fd as server socket 
+    if (listen(sock_fd, profile.backlog) == -1) {
+        fprintf(stderr, "listen error\n");
         if (connection_queue_shutdown(&queue) == -1){
-            fprintf(stderr, "shutdown error\n");
+            printf("shutdown error\n");
         }
         if (connection_queue_free(&queue) == -1){
             fprintf(stderr, "free error\n");
@@ -160,12 +556,11 @@ int main(int argc, char **argv) {
         }
         return 1;
     }
-    // Freeing server address struct as it is no longer needed to set up the server
-    freeaddrinfo(server);
-
-    // Calling listen to designate sock_fd as server socket 
-    if (listen(sock_fd, LISTEN_QUEUE_LEN) == -1) {
-        fprintf(stderr, "listen error\n");
+    
+    // Start the disk threads that load cold files for the workers
+    disk_pool_t disk_pool;
+    if (disk_pool_init(&disk_pool, &queue) == -1){
+        fprintf(stderr, "disk pool init error\n");
         if (connection_queue_shutdown(&queue) == -1){
             printf("shutdown error\n");
         }
@@ -177,17 +572,25 @@ int main(int argc, char **argv) {
         }
         return 1;
     }
-    
+
     // Give each thread job to run
     int result;
     for (int i = 0; i < N_THREADS; i++){
         (args+i)->queue = &queue;
         (args+i)->idx = i;
+        (args+i)->disk_pool = &disk_pool;
+        (args+i)->tls_ctx = tls_ctx;
+        (args+i)->request_limiter = &request_limiter;
+        (args+i)->router = &router;
+        (args+i)->profile = &profile;
         if ((result = pthread_create(threads + i, NULL, thread_func, args + i)) != 0) {
             fprintf(stderr, "pthread_create: %s\n", strerror(result));
             if (connection_queue_shutdown(&queue) == -1){
                 printf("shutdown error\n");
             }
+            if (disk_pool_shutdown(&disk_pool) == -1 || disk_pool_free(&disk_pool) == -1){
+                fprintf(stderr, "disk pool error\n");
+            }
             if (connection_queue_free(&queue) == -1){
                 fprintf(stderr, "free error\n");
             }
@@ -205,6 +608,9 @@ int main(int argc, char **argv) {
         if (connection_queue_shutdown(&queue) == -1){
             printf("shutdown error\n");
         }
+        if (disk_pool_shutdown(&disk_pool) == -1 || disk_pool_free(&disk_pool) == -1){
+            fprintf(stderr, "disk pool error\n");
+        }
         if (connection_queue_free(&queue) == -1){
             fprintf(stderr, "free error\n");
         }
@@ -219,6 +625,9 @@ int main(int argc, char **argv) {
         if (connection_queue_shutdown(&queue) == -1){
             printf("shutdown error\n");
         }
+        if (disk_pool_shutdown(&disk_pool) == -1 || disk_pool_free(&disk_pool) == -1){
+            fprintf(stderr, "disk pool error\n");
+        }
         if (connection_queue_free(&queue) == -1){
             fprintf(stderr, "free error\n");
         }
@@ -238,6 +647,9 @@ int main(int argc, char **argv) {
         if (connection_queue_shutdown(&queue) == -1){
             printf("shutdown error\n");
         }
+        if (disk_pool_shutdown(&disk_pool) == -1 || disk_pool_free(&disk_pool) == -1){
+            fprintf(stderr, "disk pool error\n");
+        }
         if (connection_queue_free(&queue) == -1){
             fprintf(stderr, "free error\n");
         }
@@ -247,12 +659,42 @@ int main(int argc, char **argv) {
         return 1;
     }
 
-    // Call to sigaction to apply the signal handler
-    if (sigaction(SIGINT, &sact, NULL) == -1){
+    // Call to sigaction to apply the signal handlers
+    struct sigaction stats_sact = sact;
+    stats_sact.sa_handler = handle_sigusr1;
+    struct sigaction reload_sact = sact;
+    reload_sact.sa_handler = handle_sighup;
+    if (sigaction(SIGINT, &sact, NULL) == -1 || sigaction(SIGUSR1, &stats_sact, NULL) == -1
+        || sigaction(SIGHUP, &reload_sact, NULL) == -1){
         fprintf(stderr, "sigaction error\n");
         if (connection_queue_shutdown(&queue) == -1){
             printf("shutdown error\n");
         }
+        if (disk_pool_shutdown(&disk_pool) == -1 || disk_pool_free(&disk_pool) == -1){
+            fprintf(stderr, "disk pool error\n");
+        }
+        if (connection_queue_free(&queue) == -1){
+            fprintf(stderr, "free error\n");
+        }
+        if (close(sock_fd) == -1){
+            perror("close");
+        }
+        return 1;
+    }
+
+    // Now that this server is accepting, the one it replaces can drain. Then
+    // wait for upgrades to this server in turn.
+    if (upgrading && upgrade_ready(&handoff) == -1){
+        fprintf(stderr, "upgrade error\n");
+    }
+    int upgrade_fd = -1;
+    if (upgrade_path != NULL && (upgrade_fd = upgrade_listen(upgrade_path)) == -1){
+        if (connection_queue_shutdown(&queue) == -1){
+            printf("shutdown error\n");
+        }
+        if (disk_pool_shutdown(&disk_pool) == -1 || disk_pool_free(&disk_pool) == -1){
+            fprintf(stderr, "disk pool error\n");
+        }
         if (connection_queue_free(&queue) == -1){
             fprintf(stderr, "free error\n");
         }
@@ -263,46 +705,129 @@ int main(int argc, char **argv) {
     }
 
     // Enqueue loop to add jobs
-    while (keep_going){
-        // Connect to client
-        int client_fd = accept(sock_fd, NULL, NULL);
-        if (client_fd == -1) {
-            if (errno != EINTR) {
-                perror("accept");
-                if (close(sock_fd) == -1){
+    int accept_failed = 0;
+    int handed_off = 0;
+    int upgrade_conn = -1;  // The new server while it starts up
+    while (keep_going && !accept_failed && !handed_off){
+        // Signals can arrive while this thread is blocked somewhere other than
+        // poll() or accept4(), e.g. waiting for room in the connection queue,
+        // so the flags they set are checked on every pass
+        handle_requests_from_signals();
+        // When accepting in batches or listening for upgrades, wait for the
+        // listener to become readable and then drain up to a batch of pending
+        // connections
+        if (profile.accept_batch > 1 || upgrade_fd != -1){
+            // poll() skips negative descriptors, so only one upgrade runs at a time
+            struct pollfd fds[3] = {
+                { .fd = sock_fd, .events = POLLIN },
+                { .fd = upgrade_conn == -1 ? upgrade_fd : -1, .events = POLLIN },
+                { .fd = upgrade_conn, .events = POLLIN },
+            };
+            if (poll(fds, 3, -1) == -1){
+                if (errno != EINTR){
+                    perror("poll");
+                    accept_failed = 1;
+                }
+                continue;
+            }
+            if (fds[1].revents & POLLIN){
+                upgrade_conn = start_upgrade(upgrade_fd, sock_fd, tls_ctx);
+            }
+            // Both servers accept until the new one reports that it is running
+            if (fds[2].revents != 0){
+                handed_off = upgrade_confirmed(upgrade_conn);
+                if (!handed_off){
+                    fprintf(stderr, "upgrade aborted by the new server\n");
+                }
+                if (close(upgrade_conn) == -1){
                     perror("close");
                 }
+                upgrade_conn = -1;
+            }
+            if (handed_off || !(fds[0].revents & POLLIN)){
+                continue;
+            }
+        }
+        for (int n = 0; n < profile.accept_batch && keep_going; n++){
+            // Connect to client
+            struct sockaddr_storage client_addr;
+            socklen_t addr_len = sizeof(client_addr);
+            int client_fd = accept4(sock_fd, (struct sockaddr *) &client_addr, &addr_len, SOCK_CLOEXEC);
+            if (client_fd == -1) {
+                // Anything but a signal, an empty listener or a client that
+                // already went away again is fatal
+                if (errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK
+                    && errno != ECONNABORTED) {
+                    perror("accept");
+                    accept_failed = 1;
+                }
+                break;
+            }
+            // Drop clients opening connections too fast before a worker sees them
+            if (!rate_limit_allow(&connection_limiter, (struct sockaddr *) &client_addr)){
+                if (close(client_fd) == -1){
+                    perror("close");
+                }
+                continue;
+            }
+            // Enqueue the client to the queue when there's a new client
+            if (connection_enqueue(&queue, client_fd) == -1){
+                printf("Error adding to queue\n");
+                if (close(client_fd) == -1){
+                    perror("close");
+                }
+                if (close(sock_fd) == -1){
+                    fprintf(stderr, "close error\n");
+                }
                 if (connection_queue_shutdown(&queue) == -1){
                     printf("shutdown error\n");
                 }
+                if (disk_pool_shutdown(&disk_pool) == -1 || disk_pool_free(&disk_pool) == -1){
+                    fprintf(stderr, "disk pool error\n");
+                }
                 if (connection_queue_free(&queue) == -1){
                     fprintf(stderr, "free error\n");
                 }
                 return 1;
-            } else {
-                break;
             }
         }
-        // Enqueue the client to the queue when there's a new client
-        if (connection_enqueue(&queue, client_fd) == -1){
-            printf("Error adding to queue\n");
-            if (close(client_fd) == -1){
-                perror("close");
-            }
-            if (close(sock_fd) == -1){
-                fprintf(stderr, "close error\n");
-            }
-            if (connection_queue_shutdown(&queue) == -1){
-                printf("shutdown error\n");
-            }
-            if (connection_queue_free(&queue) == -1){
-                fprintf(stderr, "free error\n");
-            }
-            return 1;
+    }
+    if (accept_failed){
+        if (close(sock_fd) == -1){
+            perror("close");
+        }
+        if (connection_queue_shutdown(&queue) == -1){
+            printf("shutdown error\n");
+        }
+        if (disk_pool_shutdown(&disk_pool) == -1 || disk_pool_free(&disk_pool) == -1){
+            fprintf(stderr, "disk pool error\n");
+        }
+        if (connection_queue_free(&queue) == -1){
+            fprintf(stderr, "free error\n");
         }
+        return 1;
     }
-    // Shutdown the server
-    if (connection_queue_shutdown(&queue) == -1){
+    if (upgrade_conn != -1 && close(upgrade_conn) == -1){
+        perror("close");
+    }
+    // The socket file belongs to the new server after a handoff
+    if (upgrade_fd != -1){
+        if (close(upgrade_fd) == -1){
+            perror("close");
+        }
+        if (!handed_off && unlink(upgrade_path) == -1){
+            perror("unlink");
+        }
+    }
+    // Shutdown the server. After a handoff, the new server accepts from now
+    // on and every connection already accepted here is finished first.
+    if (handed_off){
+        fprintf(stderr, "listener handed off, draining connections\n");
+        if (disk_pool_drain(&disk_pool) == -1){
+            fprintf(stderr, "disk pool error\n");
+        }
+    }
+    if ((handed_off ? connection_queue_drain(&queue) : connection_queue_shutdown(&queue)) == -1){
         printf("shutdown error\n");
         if (connection_queue_free(&queue) == -1){
             fprintf(stderr, "free error\n");
@@ -311,7 +836,7 @@ int main(int argc, char **argv) {
     }
 
     // Join all the threads
-    int exit_code;
+    int exit_code = 0;
     for (int i = 0; i < N_THREADS; i++) {
         if ((result = pthread_join(threads[i], NULL)) != 0) {
             fprintf(stderr, "pthread_join: %s\n", strerror(result));
@@ -319,6 +844,12 @@ int main(int argc, char **argv) {
         }
     }
 
+    // Stop the disk threads before the queue they hand connections back to
+    if (disk_pool_shutdown(&disk_pool) == -1 || disk_pool_free(&disk_pool) == -1){
+        fprintf(stderr, "disk pool error\n");
+        exit_code = 1;
+    }
+
     // Free everything
     if (connection_queue_free(&queue) == -1){
         fprintf(stderr, "free error\n");
@@ -333,6 +864,20 @@ int main(int argc, char **argv) {
         perror("close");
         return 1;
     }
+    if (tls_ctx != NULL){
+        tls_server_free(tls_ctx);
+    }
+    if (connection_limiter.rate > 0 || request_limiter.rate > 0){
+        print_stats();
+    }
+    if (rate_limit_free(&connection_limiter) == -1 || rate_limit_free(&request_limiter) == -1){
+        return 1;
+    }
+    if (router_handle_free(&router) == -1){
+        return 1;
+    }
+    plugin_unload_all(plugins);
+    trace_close();
 
     return exit_code;
 }
@@ -0,0 +1,145 @@
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "handler.h"
+
+/*
+ * Sample handler plugin: answers with a JSON manifest of the regular files in
+ * the directory it serves, e.g.
+ *     [{"name":"quote.txt","size":105,"mtime":1700000000}, ...]
+ * Load it with -H manifest=./manifest_handler.so[:<directory>]. Without a
+ * directory argument the manifest lists the directory of the route.
+ */
+
+#define MANIFEST_BUFSIZE 8192
+
+const int handler_abi_version = HANDLER_ABI_VERSION;
+
+// Entries are collected here and sent as one chunk whenever it fills up
+typedef struct {
+    char data[MANIFEST_BUFSIZE];
+    size_t len;
+} manifest_buf_t;
+
+// Sends what has been collected so far
+// Returns 0 on success or -1 on error
+static int flush(http_response_t *response, manifest_buf_t *buf) {
+    if (buf->len > 0 && http_response_write(response, buf->data, buf->len) == -1) {
+        return -1;
+    }
+    buf->len = 0;
+    return 0;
+}
+
+// Appends 'count' bytes to the manifest
+// Returns 0 on success or -1 on error
+static int append(http_response_t *response, manifest_buf_t *buf, const char *data,
+                  size_t count) {
+    if (buf->len + count > sizeof(buf->data) && flush(response, buf) == -1) {
+        return -1;
+    }
+    if (count > sizeof(buf->data)) {
+        return http_response_write(response, data, count);
+    }
+    memcpy(buf->data + buf->len, data, count);
+    buf->len += count;
+    return 0;
+}
+
+// Appends one entry, escaping the file name as a JSON string
+// Returns 0 on success or -1 on error
+static int append_entry(http_response_t *response, manifest_buf_t *buf, int first,
+                        const char *name, const struct stat *st) {
+    // Every byte of the name takes at most 6 once escaped
+    char entry[6 * NAME_MAX + 128];
+    size_t len = 0;
+    len += sprintf(entry, "%s{\"name\":\"", first ? "" : ",");
+    for (const unsigned char *c = (const unsigned char *) name; *c != '\0'; c++) {
+        if (*c == '"' || *c == '\\') {
+            entry[len++] = '\\';
+            entry[len++] = *c;
+        } else if (*c < 0x20) {
+            len += sprintf(entry + len, "\\u%04x", *c);
+        } else {
+            entry[len++] = *c;
+        }
+    }
+    len += sprintf(entry + len, "\",\"size\":%lld,\"mtime\":%lld}",
+                   (long long) st->st_size, (long long) st->st_mtime);
+    return append(response, buf, entry, len);
+}
+
+// Streams the manifest of the open directory 'dir'
+// Returns 0 on success or -1 on error
+static int send_manifest(http_response_t *response, DIR *dir) {
+    manifest_buf_t *buf = malloc(sizeof(manifest_buf_t));
+    if (buf == NULL) {
+        return -1;
+    }
+    buf->len = 0;
+    int result = http_response_start(response, 200, "application/json", -1);
+    if (result == 0 && !response->head_only) {
+        result = append(response, buf, "[", 1);
+        int first = 1;
+        struct dirent *entry;
+        while (result == 0 && (entry = readdir(dir)) != NULL) {
+            struct stat st;
+            if (entry->d_name[0] == '.'
+                || fstatat(dirfd(dir), entry->d_name, &st, 0) == -1
+                || !S_ISREG(st.st_mode)) {
+                continue;
+            }
+            result = append_entry(response, buf, first, entry->d_name, &st);
+            first = 0;
+        }
+        if (result == 0) {
+            result = append(response, buf, "]\n", 2);
+        }
+        if (result == 0) {
+            result = flush(response, buf);
+        }
+    }
+    free(buf);
+    if (result == 0) {
+        result = http_response_finish(response);
+    }
+    return result;
+}
+
+int handler_init(const char *args, void **state) {
+    *state = NULL;
+    if (args[0] != '\0' && (*state = strdup(args)) == NULL) {
+        perror("strdup");
+        return -1;
+    }
+    return 0;
+}
+
+int handler_handle(void *state, const handler_request_t *request, http_response_t *response) {
+    // Only the directory itself has a manifest
+    if (request->path[0] != '\0' && strcmp(request->path, "/") != 0) {
+        if (http_response_start(response, 404, NULL, 0) == -1) {
+            return -1;
+        }
+        return http_response_finish(response);
+    }
+    const char *path = state != NULL ? state : request->dir;
+    DIR *dir = opendir(path);
+    if (dir == NULL) {
+        perror(path);
+        return -1;
+    }
+    int result = send_manifest(response, dir);
+    closedir(dir);
+    return result;
+}
+
+void handler_teardown(void *state) {
+    free(state);
+}
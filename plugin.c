@@ -0,0 +1,107 @@
+#define _GNU_SOURCE
+
+#include <dlfcn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "plugin.h"
+
+// Looks up 'symbol' in the plugin's library, reporting it if missing
+static void *find_symbol(void *library, const char *path, const char *symbol) {
+    void *address = dlsym(library, symbol);
+    if (address == NULL) {
+        fprintf(stderr, "%s: missing %s\n", path, symbol);
+    }
+    return address;
+}
+
+// Loads the library at 'library_path' into 'plugin' and initializes it
+// Returns 0 on success or -1 on error
+static int open_plugin(plugin_t *plugin, const char *library_path, const char *args) {
+    if ((plugin->library = dlopen(library_path, RTLD_NOW | RTLD_LOCAL)) == NULL) {
+        fprintf(stderr, "dlopen: %s\n", dlerror());
+        return -1;
+    }
+    const int *abi_version = find_symbol(plugin->library, library_path, "handler_abi_version");
+    int (*init)(const char *, void **) = find_symbol(plugin->library, library_path, "handler_init");
+    plugin->handle = find_symbol(plugin->library, library_path, "handler_handle");
+    plugin->teardown = find_symbol(plugin->library, library_path, "handler_teardown");
+    if (abi_version == NULL || init == NULL || plugin->handle == NULL || plugin->teardown == NULL) {
+        return -1;
+    }
+    if (*abi_version != HANDLER_ABI_VERSION) {
+        fprintf(stderr, "%s: handler ABI version %d, expected %d\n", library_path,
+                *abi_version, HANDLER_ABI_VERSION);
+        return -1;
+    }
+    if (init(args, &plugin->state) == -1) {
+        fprintf(stderr, "%s: initialization failed\n", library_path);
+        return -1;
+    }
+    return 0;
+}
+
+int plugin_load(plugin_t **plugins, const char *spec) {
+    const char *path = strchr(spec, '=');
+    if (path == NULL || path == spec || path[1] == '\0') {
+        fprintf(stderr, "invalid handler plugin: %s\n", spec);
+        return -1;
+    }
+    plugin_t *plugin = calloc(1, sizeof(plugin_t));
+    if (plugin == NULL) {
+        perror("calloc");
+        return -1;
+    }
+    // Split the spec into name, path and arguments
+    plugin->name = strndup(spec, path - spec);
+    char *library_path = strdup(path + 1);
+    if (plugin->name == NULL || library_path == NULL) {
+        perror("strdup");
+        free(plugin->name);
+        free(library_path);
+        free(plugin);
+        return -1;
+    }
+    char *args = strchr(library_path, ':');
+    if (args != NULL) {
+        *args++ = '\0';
+    }
+    int result = -1;
+    if (plugin_find(*plugins, plugin->name) != NULL) {
+        fprintf(stderr, "handler plugin %s loaded twice\n", plugin->name);
+    } else {
+        result = open_plugin(plugin, library_path, args != NULL ? args : "");
+    }
+    free(library_path);
+    if (result == -1) {
+        if (plugin->library != NULL) {
+            dlclose(plugin->library);
+        }
+        free(plugin->name);
+        free(plugin);
+        return -1;
+    }
+    plugin->next = *plugins;
+    *plugins = plugin;
+    return 0;
+}
+
+const plugin_t *plugin_find(const plugin_t *plugins, const char *name) {
+    for (; plugins != NULL; plugins = plugins->next) {
+        if (strcmp(plugins->name, name) == 0) {
+            return plugins;
+        }
+    }
+    return NULL;
+}
+
+void plugin_unload_all(plugin_t *plugins) {
+    while (plugins != NULL) {
+        plugin_t *next = plugins->next;
+        plugins->teardown(plugins->state);
+        dlclose(plugins->library);
+        free(plugins->name);
+        free(plugins);
+        plugins = next;
+    }
+}
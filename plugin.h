@@ -0,0 +1,33 @@
+#ifndef PLUGIN_H
+#define PLUGIN_H
+
+#include "handler.h"
+
+// A loaded handler plugin
+typedef struct plugin {
+    char *name;
+    void *library;      // From dlopen()
+    void *state;        // From the plugin's handler_init()
+    int (*handle)(void *state, const handler_request_t *request, http_response_t *response);
+    void (*teardown)(void *state);
+    struct plugin *next;
+} plugin_t;
+
+/*
+ * Parse "<name>=<plugin.so>[:<args>]", load the plugin and initialize it.
+ * plugins: The list of loaded plugins, which the new one is added to
+ * Returns 0 on success or -1 on error
+ */
+int plugin_load(plugin_t **plugins, const char *spec);
+
+/*
+ * Returns the plugin loaded under 'name', or NULL if there is none.
+ */
+const plugin_t *plugin_find(const plugin_t *plugins, const char *name);
+
+/*
+ * Tear down and unload every plugin in the list.
+ */
+void plugin_unload_all(plugin_t *plugins);
+
+#endif // PLUGIN_H
@@ -0,0 +1,175 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "radix_trie.h"
+
+// Allocates a node whose edge is labeled with the first 'len' bytes of 'label'
+static radix_node_t *new_node(const char *label, size_t len) {
+    radix_node_t *node = calloc(1, sizeof(radix_node_t));
+    if (node == NULL) {
+        perror("calloc");
+        return NULL;
+    }
+    node->label = malloc(len + 1);
+    if (node->label == NULL) {
+        perror("malloc");
+        free(node);
+        return NULL;
+    }
+    memcpy(node->label, label, len);
+    node->label[len] = '\0';
+    node->label_len = len;
+    return node;
+}
+
+// Returns the index of the child of 'node' whose label starts with 'c', or
+// where such a child would be inserted if there is none
+static int child_index(const radix_node_t *node, unsigned char c) {
+    int low = 0;
+    int high = node->n_children;
+    while (low < high) {
+        int mid = (low + high) / 2;
+        if ((unsigned char) node->children[mid]->label[0] < c) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+// Returns the child of 'node' whose label starts with 'c', or NULL
+static radix_node_t *find_child(const radix_node_t *node, unsigned char c) {
+    int i = child_index(node, c);
+    if (i < node->n_children && (unsigned char) node->children[i]->label[0] == c) {
+        return node->children[i];
+    }
+    return NULL;
+}
+
+// Adds 'child' to 'node', keeping the children sorted
+static int add_child(radix_node_t *node, radix_node_t *child) {
+    radix_node_t **children = realloc(node->children,
+                                      (node->n_children + 1) * sizeof(radix_node_t *));
+    if (children == NULL) {
+        perror("realloc");
+        return -1;
+    }
+    node->children = children;
+    int i = child_index(node, (unsigned char) child->label[0]);
+    memmove(children + i + 1, children + i, (node->n_children - i) * sizeof(radix_node_t *));
+    children[i] = child;
+    node->n_children++;
+    return 0;
+}
+
+int radix_trie_init(radix_trie_t *trie) {
+    trie->root = new_node("", 0);
+    return trie->root == NULL ? -1 : 0;
+}
+
+int radix_trie_insert(radix_trie_t *trie, const char *key, void *value) {
+    radix_node_t *node = trie->root;
+    while (*key != '\0') {
+        radix_node_t *child = find_child(node, (unsigned char) *key);
+        if (child == NULL) {
+            // Nothing shares this part of the key: hang the rest off a new leaf
+            radix_node_t *leaf = new_node(key, strlen(key));
+            if (leaf == NULL || add_child(node, leaf) == -1) {
+                if (leaf != NULL) {
+                    free(leaf->label);
+                    free(leaf);
+                }
+                return -1;
+            }
+            leaf->value = value;
+            return 0;
+        }
+        size_t common = 0;
+        while (common < child->label_len && key[common] == child->label[common]) {
+            common++;
+        }
+        if (common < child->label_len) {
+            // The key diverges inside the child's label: split the edge
+            radix_node_t *middle = new_node(child->label, common);
+            if (middle == NULL) {
+                return -1;
+            }
+            char *rest = strdup(child->label + common);
+            middle->children = malloc(sizeof(radix_node_t *));
+            if (rest == NULL || middle->children == NULL) {
+                perror("malloc");
+                free(rest);
+                free(middle->children);
+                free(middle->label);
+                free(middle);
+                return -1;
+            }
+            free(child->label);
+            child->label = rest;
+            child->label_len -= common;
+            middle->children[0] = child;
+            middle->n_children = 1;
+            node->children[child_index(node, (unsigned char) middle->label[0])] = middle;
+            child = middle;
+        }
+        node = child;
+        key += common;
+    }
+    node->value = value;
+    return 0;
+}
+
+void *radix_trie_find(const radix_trie_t *trie, const char *key) {
+    const radix_node_t *node = trie->root;
+    while (*key != '\0') {
+        node = find_child(node, (unsigned char) *key);
+        if (node == NULL || strncmp(key, node->label, node->label_len) != 0) {
+            return NULL;
+        }
+        key += node->label_len;
+    }
+    return node->value;
+}
+
+void *radix_trie_match_prefix(const radix_trie_t *trie, const char *key, char separator,
+                              size_t *match_len) {
+    const radix_node_t *node = trie->root;
+    void *best = NULL;
+    size_t depth = 0;
+    while (1) {
+        // A key ending here matches if it ends on a separator boundary
+        if (node->value != NULL
+            && (key[depth] == '\0' || key[depth] == separator
+                || (depth > 0 && key[depth - 1] == separator))) {
+            best = node->value;
+            *match_len = depth;
+        }
+        if (key[depth] == '\0') {
+            break;
+        }
+        node = find_child(node, (unsigned char) key[depth]);
+        if (node == NULL || strncmp(key + depth, node->label, node->label_len) != 0) {
+            break;
+        }
+        depth += node->label_len;
+    }
+    return best;
+}
+
+// Frees 'node' and everything below it
+static void free_node(radix_node_t *node) {
+    for (int i = 0; i < node->n_children; i++) {
+        free_node(node->children[i]);
+    }
+    free(node->children);
+    free(node->label);
+    free(node);
+}
+
+void radix_trie_free(radix_trie_t *trie) {
+    if (trie->root != NULL) {
+        free_node(trie->root);
+        trie->root = NULL;
+    }
+}
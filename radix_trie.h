@@ -0,0 +1,55 @@
+#ifndef RADIX_TRIE_H
+#define RADIX_TRIE_H
+
+#include <stddef.h>
+
+// A node of a radix trie. Each edge is labeled with a string and no node has
+// two children whose labels start with the same byte, so a lookup touches at
+// most one node per label and its cost depends on the key's length, not on
+// the number of keys stored.
+typedef struct radix_node {
+    char *label;                    // Label of the edge leading to this node
+    size_t label_len;
+    void *value;                    // NULL if no key ends at this node
+    struct radix_node **children;   // Sorted by the first byte of their label
+    int n_children;
+} radix_node_t;
+
+typedef struct {
+    radix_node_t *root;
+} radix_trie_t;
+
+/*
+ * Initialize an empty trie.
+ * Returns 0 on success or -1 on error
+ */
+int radix_trie_init(radix_trie_t *trie);
+
+/*
+ * Associate 'value' (which must not be NULL) with 'key', replacing any value
+ * already stored for it.
+ * Returns 0 on success or -1 on error
+ */
+int radix_trie_insert(radix_trie_t *trie, const char *key, void *value);
+
+/*
+ * Returns the value stored for exactly 'key', or NULL if there is none.
+ */
+void *radix_trie_find(const radix_trie_t *trie, const char *key);
+
+/*
+ * Returns the value of the longest stored key that is a prefix of 'key' and
+ * ends at a 'separator' boundary: the stored key either ends with
+ * 'separator', or is followed in 'key' by 'separator' or the end of 'key'.
+ * match_len: Set to the length of the matching stored key
+ * Returns NULL if no stored key matches
+ */
+void *radix_trie_match_prefix(const radix_trie_t *trie, const char *key, char separator,
+                              size_t *match_len);
+
+/*
+ * Deallocates all nodes of the trie. Values are not freed.
+ */
+void radix_trie_free(radix_trie_t *trie);
+
+#endif // RADIX_TRIE_H
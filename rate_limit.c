@@ -0,0 +1,315 @@
+#include <netinet/in.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "rate_limit.h"
+
+int rate_limit_parse(const char *spec, double *rate, double *burst) {
+    char *end;
+    *rate = strtod(spec, &end);
+    if (end == spec || *rate < 0) {
+        return -1;
+    }
+    if (*end == '\0') {
+        *burst = *rate < 1 ? 1 : *rate;
+        return 0;
+    }
+    if (*end != ':') {
+        return -1;
+    }
+    const char *burst_spec = end + 1;
+    *burst = strtod(burst_spec, &end);
+    if (end == burst_spec || *end != '\0' || *burst < 1) {
+        return -1;
+    }
+    return 0;
+}
+
+int rate_limit_init(rate_limiter_t *limiter, double rate, double burst) {
+    limiter->rate = rate;
+    limiter->burst = burst;
+    limiter->rejections = 0;
+    int result;
+    for (int i = 0; i < RATE_LIMIT_SHARDS; i++) {
+        rate_limit_shard_t *shard = limiter->shards + i;
+        memset(shard->buckets, 0, sizeof(shard->buckets));
+        shard->newest = NULL;
+        shard->oldest = NULL;
+        shard->n_entries = 0;
+        if ((result = pthread_mutex_init(&shard->lock, NULL)) != 0) {
+            fprintf(stderr, "pthread_mutex_init: %s\n", strerror(result));
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Copies the client part of the IP address of 'addr' into 'key': IPv4
+// addresses are mapped into IPv6 and IPv6 addresses are cut to their /64
+// Returns 0 on success or -1 for other address families
+static int address_key(const struct sockaddr *addr, unsigned char key[16]) {
+    if (addr->sa_family == AF_INET6) {
+        const struct in6_addr *addr6 = &((const struct sockaddr_in6 *) addr)->sin6_addr;
+        memcpy(key, addr6, 16);
+        if (!IN6_IS_ADDR_V4MAPPED(addr6)) {
+            memset(key + 8, 0, 8);
+        }
+        return 0;
+    }
+    if (addr->sa_family == AF_INET) {
+        memset(key, 0, 10);
+        key[10] = 0xff;
+        key[11] = 0xff;
+        memcpy(key + 12, &((const struct sockaddr_in *) addr)->sin_addr, 4);
+        return 0;
+    }
+    return -1;
+}
+
+// FNV-1a hash of an address key
+static unsigned int hash_key(const unsigned char key[16]) {
+    unsigned int hash = 2166136261u;
+    for (int i = 0; i < 16; i++) {
+        hash = (hash ^ key[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static rate_limit_shard_t *key_shard(rate_limiter_t *limiter, unsigned int hash) {
+    return limiter->shards + hash % RATE_LIMIT_SHARDS;
+}
+
+static rate_limit_entry_t **key_bucket(rate_limit_shard_t *shard, unsigned int hash) {
+    return shard->buckets + (hash / RATE_LIMIT_SHARDS) % RATE_LIMIT_BUCKETS;
+}
+
+static double now_secs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Makes 'entry' the newest entry of 'shard'
+static void make_newest(rate_limit_shard_t *shard, rate_limit_entry_t *entry) {
+    if (shard->newest == entry) {
+        return;
+    }
+    // Unlink it if it is already on the list
+    if (entry->older != NULL) {
+        entry->older->newer = entry->newer;
+    } else if (shard->oldest == entry) {
+        shard->oldest = entry->newer;
+    }
+    if (entry->newer != NULL) {
+        entry->newer->older = entry->older;
+    }
+    entry->older = shard->newest;
+    entry->newer = NULL;
+    if (shard->newest != NULL) {
+        shard->newest->newer = entry;
+    }
+    shard->newest = entry;
+    if (shard->oldest == NULL) {
+        shard->oldest = entry;
+    }
+}
+
+// Removes the oldest entry of 'shard' and frees it
+static void drop_oldest(rate_limit_shard_t *shard) {
+    rate_limit_entry_t *entry = shard->oldest;
+    rate_limit_entry_t **link = key_bucket(shard, hash_key(entry->addr));
+    while (*link != entry) {
+        link = &(*link)->next;
+    }
+    *link = entry->next;
+    shard->oldest = entry->newer;
+    if (shard->oldest != NULL) {
+        shard->oldest->older = NULL;
+    } else {
+        shard->newest = NULL;
+    }
+    free(entry);
+    shard->n_entries--;
+}
+
+// Starts tracking the client 'key' in 'shard', making room if the shard is full
+// Returns the new entry or NULL if it can't be allocated
+static rate_limit_entry_t *add_entry(rate_limit_shard_t *shard, rate_limit_entry_t **bucket,
+                                     const unsigned char key[16], double tokens,
+                                     double last_refill) {
+    if (shard->n_entries >= RATE_LIMIT_MAX_ENTRIES / RATE_LIMIT_SHARDS) {
+        drop_oldest(shard);
+    }
+    rate_limit_entry_t *entry = calloc(1, sizeof(rate_limit_entry_t));
+    if (entry == NULL) {
+        return NULL;
+    }
+    memcpy(entry->addr, key, 16);
+    entry->tokens = tokens;
+    entry->last_refill = last_refill;
+    entry->next = *bucket;
+    *bucket = entry;
+    make_newest(shard, entry);
+    shard->n_entries++;
+    return entry;
+}
+
+int rate_limit_allow(rate_limiter_t *limiter, const struct sockaddr *addr) {
+    unsigned char key[16];
+    if (limiter->rate <= 0 || addr == NULL || address_key(addr, key) == -1) {
+        return 1;
+    }
+    unsigned int hash = hash_key(key);
+    rate_limit_shard_t *shard = key_shard(limiter, hash);
+    rate_limit_entry_t **bucket = key_bucket(shard, hash);
+    double now = now_secs();
+    // Time after which an idle client's bucket is full again
+    double idle_expiry = limiter->burst / limiter->rate;
+
+    int result;
+    if ((result = pthread_mutex_lock(&shard->lock)) != 0) {
+        fprintf(stderr, "pthread_mutex_lock: %s\n", strerror(result));
+        return 1;
+    }
+    // Entries are ordered by last refill, so the expired ones are the oldest
+    while (shard->oldest != NULL && now - shard->oldest->last_refill >= idle_expiry) {
+        drop_oldest(shard);
+    }
+    rate_limit_entry_t *entry = *bucket;
+    while (entry != NULL && memcmp(entry->addr, key, 16) != 0) {
+        entry = entry->next;
+    }
+
+    int allowed = 1;
+    if (entry == NULL) {
+        // New client: start with a full bucket
+        add_entry(shard, bucket, key, limiter->burst - 1, now);
+    } else {
+        entry->tokens += (now - entry->last_refill) * limiter->rate;
+        if (entry->tokens > limiter->burst) {
+            entry->tokens = limiter->burst;
+        }
+        entry->last_refill = now;
+        make_newest(shard, entry);
+        if (entry->tokens >= 1) {
+            entry->tokens -= 1;
+        } else {
+            allowed = 0;
+        }
+    }
+
+    if ((result = pthread_mutex_unlock(&shard->lock)) != 0) {
+        fprintf(stderr, "pthread_mutex_unlock: %s\n", strerror(result));
+    }
+    if (!allowed) {
+        __atomic_fetch_add(&limiter->rejections, 1, __ATOMIC_RELAXED);
+    }
+    return allowed;
+}
+
+// How a client's state is laid out in a snapshot. Refill times are on the
+// monotonic clock, which other processes on the same machine share.
+typedef struct {
+    unsigned char addr[16];
+    double tokens;
+    double last_refill;
+} rate_limit_record_t;
+
+void *rate_limit_save(rate_limiter_t *limiter, size_t *len) {
+    size_t capacity = RATE_LIMIT_BUCKETS;
+    uint32_t count = 0;
+    rate_limit_record_t *records = malloc(capacity * sizeof(rate_limit_record_t));
+    if (records == NULL) {
+        perror("malloc");
+        return NULL;
+    }
+    for (int i = 0; i < RATE_LIMIT_SHARDS; i++) {
+        rate_limit_shard_t *shard = limiter->shards + i;
+        pthread_mutex_lock(&shard->lock);
+        if (count + shard->n_entries > capacity) {
+            capacity = (count + shard->n_entries) * 2;
+            rate_limit_record_t *grown = realloc(records, capacity * sizeof(rate_limit_record_t));
+            if (grown == NULL) {
+                perror("realloc");
+                pthread_mutex_unlock(&shard->lock);
+                free(records);
+                return NULL;
+            }
+            records = grown;
+        }
+        // Oldest first, so that restoring them in order keeps them ordered
+        for (rate_limit_entry_t *entry = shard->oldest; entry != NULL; entry = entry->newer) {
+            memcpy(records[count].addr, entry->addr, 16);
+            records[count].tokens = entry->tokens;
+            records[count].last_refill = entry->last_refill;
+            count++;
+        }
+        pthread_mutex_unlock(&shard->lock);
+    }
+
+    // A count of records, followed by the records themselves
+    *len = sizeof(count) + count * sizeof(rate_limit_record_t);
+    char *snapshot = malloc(*len);
+    if (snapshot == NULL) {
+        perror("malloc");
+        free(records);
+        return NULL;
+    }
+    memcpy(snapshot, &count, sizeof(count));
+    memcpy(snapshot + sizeof(count), records, count * sizeof(rate_limit_record_t));
+    free(records);
+    return snapshot;
+}
+
+ssize_t rate_limit_restore(rate_limiter_t *limiter, const void *snapshot, size_t len) {
+    uint32_t count;
+    if (len < sizeof(count)) {
+        return -1;
+    }
+    memcpy(&count, snapshot, sizeof(count));
+    if ((len - sizeof(count)) / sizeof(rate_limit_record_t) < count) {
+        return -1;
+    }
+    const char *pos = (const char *) snapshot + sizeof(count);
+    for (uint32_t i = 0; i < count && limiter->rate > 0; i++) {
+        rate_limit_record_t record;
+        memcpy(&record, pos + i * sizeof(rate_limit_record_t), sizeof(record));
+        unsigned int hash = hash_key(record.addr);
+        rate_limit_shard_t *shard = key_shard(limiter, hash);
+        pthread_mutex_lock(&shard->lock);
+        add_entry(shard, key_bucket(shard, hash), record.addr,
+                  record.tokens < limiter->burst ? record.tokens : limiter->burst,
+                  record.last_refill);
+        pthread_mutex_unlock(&shard->lock);
+    }
+    return sizeof(count) + count * sizeof(rate_limit_record_t);
+}
+
+unsigned long rate_limit_rejections(rate_limiter_t *limiter) {
+    return __atomic_load_n(&limiter->rejections, __ATOMIC_RELAXED);
+}
+
+int rate_limit_free(rate_limiter_t *limiter) {
+    int result;
+    for (int i = 0; i < RATE_LIMIT_SHARDS; i++) {
+        rate_limit_shard_t *shard = limiter->shards + i;
+        for (int j = 0; j < RATE_LIMIT_BUCKETS; j++) {
+            rate_limit_entry_t *entry = shard->buckets[j];
+            while (entry != NULL) {
+                rate_limit_entry_t *next = entry->next;
+                free(entry);
+                entry = next;
+            }
+            shard->buckets[j] = NULL;
+        }
+        shard->newest = NULL;
+        shard->oldest = NULL;
+        if ((result = pthread_mutex_destroy(&shard->lock)) != 0) {
+            fprintf(stderr, "lock pthread_mutex_destroy: %s\n", strerror(result));
+            return -1;
+        }
+    }
+    return 0;
+}
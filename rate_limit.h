@@ -0,0 +1,93 @@
+#ifndef RATE_LIMIT_H
+#define RATE_LIMIT_H
+
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#define RATE_LIMIT_SHARDS 16
+#define RATE_LIMIT_BUCKETS 256
+#define RATE_LIMIT_MAX_ENTRIES 65536
+
+// Token bucket state for a single client: an IPv4 address (stored
+// IPv4-mapped) or an IPv6 /64, since one host can hold a whole /64
+typedef struct rate_limit_entry {
+    unsigned char addr[16];
+    double tokens;
+    double last_refill;
+    struct rate_limit_entry *next;
+    struct rate_limit_entry *older;     // Shard entries by last refill
+    struct rate_limit_entry *newer;
+} rate_limit_entry_t;
+
+// One lock stripe of the table. Clients hash to a shard so that threads
+// checking different clients rarely contend for the same lock.
+typedef struct {
+    pthread_mutex_t lock;
+    rate_limit_entry_t *buckets[RATE_LIMIT_BUCKETS];
+    rate_limit_entry_t *newest;
+    rate_limit_entry_t *oldest;
+    int n_entries;
+} rate_limit_shard_t;
+
+// Struct representing a per-client rate limiter: every client address gets
+// 'burst' tokens which refill at 'rate' per second, and each event costs one
+typedef struct {
+    double rate;
+    double burst;
+    unsigned long rejections;
+    rate_limit_shard_t shards[RATE_LIMIT_SHARDS];
+} rate_limiter_t;
+
+/*
+ * Parse a limit of the form "<rate>" or "<rate>:<burst>", in events per second.
+ * The burst defaults to the rate (but at least 1).
+ * Returns 0 on success or -1 if 'spec' is malformed
+ */
+int rate_limit_parse(const char *spec, double *rate, double *burst);
+
+/*
+ * Initialize a rate limiter.
+ * limiter: Pointer to rate_limiter_t to be initialized
+ * rate: Tokens added per second, or 0 to allow everything
+ * burst: Maximum number of tokens a client can save up
+ * Returns 0 on success or -1 on error
+ */
+int rate_limit_init(rate_limiter_t *limiter, double rate, double burst);
+
+/*
+ * Take a token for the client at 'addr'. Entries of clients whose bucket has
+ * filled up again are dropped, since they behave exactly like a client seen
+ * for the first time. When a shard is full anyway, the client that has gone
+ * longest without an event makes room for the new one.
+ * Returns 1 if the event is allowed or 0 if it should be rejected
+ */
+int rate_limit_allow(rate_limiter_t *limiter, const struct sockaddr *addr);
+
+/*
+ * Returns the number of events rejected so far.
+ */
+unsigned long rate_limit_rejections(rate_limiter_t *limiter);
+
+/*
+ * Serialize the state of every tracked client, so that a server taking over
+ * from this one can carry on with it.
+ * len: Set to the size of the snapshot
+ * Returns the heap-allocated snapshot or NULL on error
+ */
+void *rate_limit_save(rate_limiter_t *limiter, size_t *len);
+
+/*
+ * Load client state from a snapshot taken with rate_limit_save(), capping
+ * saved tokens at this limiter's burst.
+ * Returns the number of bytes of 'snapshot' used or -1 if it is malformed
+ */
+ssize_t rate_limit_restore(rate_limiter_t *limiter, const void *snapshot, size_t len);
+
+/*
+ * Deallocates and cleans up any resources associated with a rate limiter.
+ * Returns 0 on success or -1 on error
+ */
+int rate_limit_free(rate_limiter_t *limiter);
+
+#endif // RATE_LIMIT_H
@@ -0,0 +1,335 @@
+#define _GNU_SOURCE
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "router.h"
+
+// Cached responses stay fresh for an hour unless a route says otherwise
+#define DEFAULT_MAX_AGE 3600
+
+// Allocates an empty virtual host owned by 'router'
+static vhost_t *new_vhost(router_t *router) {
+    vhost_t *vhost = calloc(1, sizeof(vhost_t));
+    if (vhost == NULL) {
+        perror("calloc");
+        return NULL;
+    }
+    if (radix_trie_init(&vhost->routes) == -1) {
+        free(vhost);
+        return NULL;
+    }
+    vhost->next = router->vhost_list;
+    router->vhost_list = vhost;
+    return vhost;
+}
+
+// Adds a route to 'vhost'. 'rate' is 0 for routes without a rate limit.
+// Returns 0 on success or -1 on error
+static int add_route(vhost_t *vhost, const char *prefix, const char *dir,
+                     const plugin_t *handler, const http_policy_t *policy,
+                     double rate, double burst) {
+    if (prefix[0] != '/' || radix_trie_find(&vhost->routes, prefix) != NULL) {
+        return -1;
+    }
+    route_t *route = calloc(1, sizeof(route_t));
+    if (route == NULL) {
+        perror("calloc");
+        return -1;
+    }
+    route->next = vhost->route_list;
+    vhost->route_list = route;
+    route->policy = *policy;
+    route->handler = handler;
+    route->prefix = strdup(prefix);
+    route->dir = strdup(dir);
+    if (route->prefix == NULL || route->dir == NULL) {
+        perror("strdup");
+        return -1;
+    }
+    // Targets always start with a slash, which route_path() puts back
+    size_t dir_len = strlen(route->dir);
+    while (dir_len > 1 && route->dir[dir_len - 1] == '/') {
+        route->dir[--dir_len] = '\0';
+    }
+    if (rate > 0) {
+        if ((route->limiter = malloc(sizeof(rate_limiter_t))) == NULL) {
+            perror("malloc");
+            return -1;
+        }
+        if (rate_limit_init(route->limiter, rate, burst) == -1) {
+            free(route->limiter);
+            route->limiter = NULL;
+            return -1;
+        }
+    }
+    return radix_trie_insert(&vhost->routes, route->prefix, route);
+}
+
+// Parses "on" or "off" into 'flag'
+// Returns 0 on success or -1 for anything else
+static int parse_switch(const char *value, int *flag) {
+    if (strcmp(value, "on") == 0) {
+        *flag = 1;
+    } else if (strcmp(value, "off") == 0) {
+        *flag = 0;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+// Parses the names after "host" and starts a virtual host for them
+// Returns 0 on success or -1 on error
+static int parse_host_line(router_t *router, vhost_t **vhost, char **save_ptr) {
+    if ((*vhost = new_vhost(router)) == NULL) {
+        return -1;
+    }
+    int n_names = 0;
+    for (char *name = strtok_r(NULL, " \t", save_ptr); name != NULL;
+         name = strtok_r(NULL, " \t", save_ptr), n_names++) {
+        for (char *c = name; *c != '\0'; c++) {
+            *c = tolower((unsigned char) *c);
+        }
+        if (strcmp(name, "*") == 0) {
+            if (router->default_host != NULL) {
+                return -1;
+            }
+            router->default_host = *vhost;
+        } else if (radix_trie_find(&router->hosts, name) != NULL
+                   || radix_trie_insert(&router->hosts, name, *vhost) == -1) {
+            return -1;
+        }
+    }
+    return n_names > 0 ? 0 : -1;
+}
+
+// Parses the prefix and settings after "route" and adds the route to 'vhost'
+// Returns 0 on success or -1 on error
+static int parse_route_line(vhost_t *vhost, char **save_ptr, const char *default_dir,
+                            const plugin_t *plugins) {
+    const char *prefix = strtok_r(NULL, " \t", save_ptr);
+    const char *dir = NULL;
+    const plugin_t *handler = NULL;
+    http_policy_t policy = { .cache = -1, .max_age = DEFAULT_MAX_AGE, .compress = 0 };
+    double rate = 0, burst = 1;
+    if (prefix == NULL) {
+        return -1;
+    }
+    for (char *setting = strtok_r(NULL, " \t", save_ptr); setting != NULL;
+         setting = strtok_r(NULL, " \t", save_ptr)) {
+        char *value = strchr(setting, '=');
+        if (value == NULL) {
+            return -1;
+        }
+        *value++ = '\0';
+        char *end;
+        if (strcmp(setting, "dir") == 0) {
+            dir = value;
+        } else if (strcmp(setting, "handler") == 0) {
+            if ((handler = plugin_find(plugins, value)) == NULL) {
+                return -1;
+            }
+        } else if (strcmp(setting, "cache") == 0) {
+            if (parse_switch(value, &policy.cache) == -1) {
+                return -1;
+            }
+        } else if (strcmp(setting, "max_age") == 0) {
+            policy.max_age = strtol(value, &end, 10);
+            if (end == value || *end != '\0' || policy.max_age < 0) {
+                return -1;
+            }
+        } else if (strcmp(setting, "compress") == 0) {
+            if (parse_switch(value, &policy.compress) == -1) {
+                return -1;
+            }
+        } else if (strcmp(setting, "rate") == 0) {
+            if (rate_limit_parse(value, &rate, &burst) == -1) {
+                return -1;
+            }
+        } else {
+            return -1;
+        }
+    }
+    // Handlers write their own bodies, which aren't compressed
+    if (handler != NULL && policy.compress) {
+        return -1;
+    }
+    if (dir == NULL && handler != NULL) {
+        dir = default_dir != NULL ? default_dir : ".";
+    }
+    if (dir == NULL) {
+        return -1;
+    }
+    return add_route(vhost, prefix, dir, handler, &policy, rate, burst);
+}
+
+// Adds the virtual hosts defined in the file at 'path' to 'router'
+// Returns 0 on success or -1 on error
+static int load_config(router_t *router, const char *path, const char *default_dir,
+                       const plugin_t *plugins) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        perror(path);
+        return -1;
+    }
+    char *line = NULL;
+    size_t line_size = 0;
+    int line_no = 0;
+    int result = 0;
+    vhost_t *vhost = NULL;
+    while (result == 0 && getline(&line, &line_size, file) != -1) {
+        line_no++;
+        line[strcspn(line, "#\r\n")] = '\0';
+        char *save_ptr;
+        const char *keyword = strtok_r(line, " \t", &save_ptr);
+        if (keyword == NULL) {
+            continue;
+        }
+        if (strcmp(keyword, "host") == 0) {
+            result = parse_host_line(router, &vhost, &save_ptr);
+        } else if (strcmp(keyword, "route") == 0 && vhost != NULL) {
+            result = parse_route_line(vhost, &save_ptr, default_dir, plugins);
+        } else {
+            result = -1;
+        }
+        if (result == -1) {
+            fprintf(stderr, "%s:%d: invalid configuration\n", path, line_no);
+        }
+    }
+    free(line);
+    if (fclose(file) != 0) {
+        perror("fclose");
+        return -1;
+    }
+    return result;
+}
+
+router_t *router_load(const char *config_path, const char *default_dir,
+                      const plugin_t *plugins) {
+    router_t *router = calloc(1, sizeof(router_t));
+    if (router == NULL) {
+        perror("calloc");
+        return NULL;
+    }
+    if (radix_trie_init(&router->hosts) == -1) {
+        free(router);
+        return NULL;
+    }
+    if (config_path != NULL && load_config(router, config_path, default_dir, plugins) == -1) {
+        router_free(router);
+        return NULL;
+    }
+    // Everything else goes to the directory given on the command line
+    if (router->default_host == NULL && default_dir != NULL) {
+        http_policy_t policy = { .cache = -1, .max_age = 0, .compress = 0 };
+        if ((router->default_host = new_vhost(router)) == NULL
+            || add_route(router->default_host, "/", default_dir, NULL, &policy, 0, 1) == -1) {
+            router_free(router);
+            return NULL;
+        }
+        for (const plugin_t *plugin = plugins; plugin != NULL; plugin = plugin->next) {
+            char prefix[256];
+            snprintf(prefix, sizeof(prefix), "/%s", plugin->name);
+            if (add_route(router->default_host, prefix, default_dir, plugin, &policy, 0, 1) == -1) {
+                fprintf(stderr, "can't route %s to handler plugin %s\n", prefix, plugin->name);
+                router_free(router);
+                return NULL;
+            }
+        }
+    }
+    return router;
+}
+
+const route_t *router_match(const router_t *router, const char *host, const char *target,
+                            size_t *prefix_len) {
+    const vhost_t *vhost = host[0] != '\0' ? radix_trie_find(&router->hosts, host) : NULL;
+    if (vhost == NULL && (vhost = router->default_host) == NULL) {
+        return NULL;
+    }
+    return radix_trie_match_prefix(&vhost->routes, target, '/', prefix_len);
+}
+
+int route_path(const route_t *route, const char *target, size_t prefix_len,
+               char *path, size_t size) {
+    const char *rest = target + prefix_len;
+    if (*rest == '/') {
+        rest++;
+    }
+    int len = snprintf(path, size, "%s/%s", route->dir, rest);
+    return len < 0 || (size_t) len >= size ? -1 : 0;
+}
+
+void router_free(router_t *router) {
+    vhost_t *vhost = router->vhost_list;
+    while (vhost != NULL) {
+        route_t *route = vhost->route_list;
+        while (route != NULL) {
+            route_t *next_route = route->next;
+            if (route->limiter != NULL) {
+                rate_limit_free(route->limiter);
+                free(route->limiter);
+            }
+            free(route->prefix);
+            free(route->dir);
+            free(route);
+            route = next_route;
+        }
+        radix_trie_free(&vhost->routes);
+        vhost_t *next_vhost = vhost->next;
+        free(vhost);
+        vhost = next_vhost;
+    }
+    radix_trie_free(&router->hosts);
+    free(router);
+}
+
+int router_handle_init(router_handle_t *handle, router_t *router) {
+    int result;
+    if ((result = pthread_mutex_init(&handle->lock, NULL)) != 0) {
+        fprintf(stderr, "pthread_mutex_init: %s\n", strerror(result));
+        return -1;
+    }
+    // The handle holds a reference of its own to the current router
+    handle->current = router;
+    router->refs = 1;
+    return 0;
+}
+
+router_t *router_acquire(router_handle_t *handle) {
+    pthread_mutex_lock(&handle->lock);
+    router_t *router = handle->current;
+    router->refs++;
+    pthread_mutex_unlock(&handle->lock);
+    return router;
+}
+
+void router_release(router_handle_t *handle, router_t *router) {
+    pthread_mutex_lock(&handle->lock);
+    int unused = --router->refs == 0;
+    pthread_mutex_unlock(&handle->lock);
+    if (unused) {
+        router_free(router);
+    }
+}
+
+void router_replace(router_handle_t *handle, router_t *router) {
+    pthread_mutex_lock(&handle->lock);
+    router_t *old = handle->current;
+    handle->current = router;
+    router->refs++;
+    pthread_mutex_unlock(&handle->lock);
+    router_release(handle, old);
+}
+
+int router_handle_free(router_handle_t *handle) {
+    router_release(handle, handle->current);
+    handle->current = NULL;
+    int result;
+    if ((result = pthread_mutex_destroy(&handle->lock)) != 0) {
+        fprintf(stderr, "pthread_mutex_destroy: %s\n", strerror(result));
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,119 @@
+#ifndef ROUTER_H
+#define ROUTER_H
+
+#include <pthread.h>
+#include <stddef.h>
+
+#include "http.h"
+#include "plugin.h"
+#include "radix_trie.h"
+#include "rate_limit.h"
+
+// A route maps request targets starting with 'prefix' into 'dir', or hands
+// them to a handler plugin
+typedef struct route {
+    char *prefix;
+    char *dir;
+    const plugin_t *handler;    // NULL for routes serving files
+    http_policy_t policy;
+    rate_limiter_t *limiter;    // NULL if the route has no rate limit
+    struct route *next;
+} route_t;
+
+// A virtual host and its routes, keyed by prefix
+typedef struct vhost {
+    radix_trie_t routes;
+    route_t *route_list;
+    struct vhost *next;
+} vhost_t;
+
+// An immutable set of virtual hosts. Workers hold a reference to the router
+// while they use it, so that a reloaded configuration can replace it without
+// pulling routes out from under requests still being dispatched.
+typedef struct {
+    radix_trie_t hosts;         // Lower case host name -> vhost_t
+    vhost_t *default_host;      // For requests whose Host matches no name
+    vhost_t *vhost_list;
+    int refs;
+} router_t;
+
+// The router currently in use
+typedef struct {
+    pthread_mutex_t lock;
+    router_t *current;
+} router_handle_t;
+
+/*
+ * Build a router from a configuration file with lines of the form
+ *     host <name>...
+ *         route <prefix> dir=<directory> [cache=on|off] [max_age=<secs>]
+ *                        [compress=on|off] [rate=<reqs/s>[:<burst>]]
+ *         route <prefix> handler=<plugin name> [dir=<directory>] ...
+ * where routes belong to the host above them, a host named "*" matches any
+ * Host not listed elsewhere and '#' starts a comment. Handler routes take the
+ * same settings as other routes, except compress=on.
+ * config_path: The file to read, or NULL for no virtual hosts
+ * default_dir: If not NULL, requests for unknown hosts are served from this
+ *              directory unless the configuration has a "*" host. It is
+ *              also the directory of handler routes that don't set one.
+ * plugins: Handlers that routes can name. Each one also answers /<name> on
+ *          the hosts served from 'default_dir'.
+ * Returns the new router or NULL on error
+ */
+router_t *router_load(const char *config_path, const char *default_dir,
+                      const plugin_t *plugins);
+
+/*
+ * Find the route for a request.
+ * host: The lower case Host of the request, or "" if it had none
+ * target: The request target
+ * prefix_len: Set to the length of the route's prefix
+ * Returns the route or NULL if none matches
+ */
+const route_t *router_match(const router_t *router, const char *host, const char *target,
+                            size_t *prefix_len);
+
+/*
+ * Map 'target', which matched 'route' with a prefix of 'prefix_len' bytes, to
+ * a path in the route's directory.
+ * Returns 0 on success or -1 if the path doesn't fit into 'size' bytes
+ */
+int route_path(const route_t *route, const char *target, size_t prefix_len,
+               char *path, size_t size);
+
+/*
+ * Deallocates a router and its routes.
+ */
+void router_free(router_t *router);
+
+/*
+ * Initialize a handle to use 'router', which it takes ownership of.
+ * Returns 0 on success or -1 on error
+ */
+int router_handle_init(router_handle_t *handle, router_t *router);
+
+/*
+ * Take a reference to the current router, to be given back with
+ * router_release() once the caller is done with it and its routes.
+ */
+router_t *router_acquire(router_handle_t *handle);
+
+/*
+ * Give back a reference taken with router_acquire(). A router that has been
+ * replaced is freed once its last reference is released.
+ */
+void router_release(router_handle_t *handle, router_t *router);
+
+/*
+ * Make 'router' the current router. Requests already dispatched keep using the
+ * old one, which is freed once they release it.
+ */
+void router_replace(router_handle_t *handle, router_t *router);
+
+/*
+ * Releases the current router and cleans up the handle.
+ * Returns 0 on success or -1 on error
+ */
+int router_handle_free(router_handle_t *handle);
+
+#endif // ROUTER_H
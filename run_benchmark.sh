@@ -0,0 +1,70 @@
+#! /bin/bash
+
+# Simple load generator: fires REQUESTS requests at the server, CONCURRENCY
+# at a time, and reports throughput and latency percentiles.
+# Set PRELOAD to a shared object (e.g. ./concurrent_open.so together with
+# FAULT_* variables) to run the server under syscall fault injection.
+# Requests are made with curl, one process per request, so latencies of a few
+# milliseconds are mostly process startup. CLIENT=bench_client makes them all
+# from one process instead (plain HTTP only, options in CLIENT_OPTS), which
+# resolves sub-millisecond differences such as those between socket profiles.
+
+PORT=${PORT:-8000}
+REQUESTS=${REQUESTS:-500}
+CONCURRENCY=${CONCURRENCY:-10}
+SERVER_DIR=${SERVER_DIR:-server_files}
+SERVER_ARGS=${SERVER_ARGS:-}
+URL_BASE=${URL_BASE:-http://localhost:$PORT}
+CURL_OPTS=${CURL_OPTS:-}
+CLIENT=${CLIENT:-curl}
+CLIENT_OPTS=${CLIENT_OPTS:-}
+target_files=(${TARGETS:-quote.txt index.html gatsby.txt ocelot.jpg Lec01.pdf})
+
+# The open() barrier would stall a benchmark, so it is off unless asked for
+export FAULT_BARRIER=${FAULT_BARRIER:-0}
+
+if [ -n "$PRELOAD" ]; then
+    LD_PRELOAD=$PRELOAD ./http_server $SERVER_ARGS $SERVER_DIR $PORT &
+else
+    ./http_server $SERVER_ARGS $SERVER_DIR $PORT &
+fi
+http_server_pid=$!
+
+# Wait for the server to start listening
+for i in $(seq 50)
+do
+    curl -s -o /dev/null $CURL_OPTS $URL_BASE/${target_files[0]} && break
+    sleep 0.1
+done
+
+latencies=$(mktemp)
+start=$(date +%s.%N)
+if [ "$CLIENT" = bench_client ]; then
+    ./bench_client -n $REQUESTS -c $CONCURRENCY $CLIENT_OPTS localhost $PORT \
+                   ${target_files[@]} >> $latencies
+else
+    for i in $(seq $REQUESTS)
+    do
+        echo "$URL_BASE/${target_files[$((i % ${#target_files[@]}))]}"
+    done | xargs -P $CONCURRENCY -n 1 curl -s -o /dev/null $CURL_OPTS \
+                 -w "%{http_code} %{time_total}\n" >> $latencies
+fi
+end=$(date +%s.%N)
+
+kill -INT $http_server_pid
+wait $http_server_pid
+
+sort -k2 -n $latencies | awk -v start=$start -v end=$end '
+    { code[NR] = $1; time[NR] = $2; if ($1 != 200) failed++ }
+    END {
+        elapsed = end - start
+        p50 = int(NR * 0.50); if (p50 < 1) p50 = 1
+        p99 = int(NR * 0.99); if (p99 < 1) p99 = 1
+        printf "requests:    %d (%d failed)\n", NR, failed
+        printf "elapsed:     %.3f s\n", elapsed
+        printf "throughput:  %.1f req/s\n", NR / elapsed
+        printf "p50 latency: %.2f ms\n", time[p50] * 1000
+        printf "p99 latency: %.2f ms\n", time[p99] * 1000
+        printf "max latency: %.2f ms\n", time[NR] * 1000
+    }'
+rm -f $latencies
@@ -0,0 +1,26 @@
+#! /bin/bash
+
+rm -rf downloaded_files
+mkdir -p downloaded_files/listing
+cp server_files/quote.txt downloaded_files/listing/
+printf 'host list.test\n    route /files handler=manifest dir=downloaded_files/listing cache=off\n' \
+       > downloaded_files/vhosts.conf
+echo "Starting Plugin Server"
+./http_server -H manifest=./manifest_handler.so -c downloaded_files/vhosts.conf server_files $PORT &
+http_server_pid=$!
+sleep 0.2
+
+echo "Retrieving manifests"
+curl -s -S http://localhost:$PORT/manifest -o downloaded_files/manifest.json
+grep -o '{"name":"quote.txt","size":[0-9]*' downloaded_files/manifest.json
+curl -s -o /dev/null -w "manifest/quote.txt: %{http_code}\n" http://localhost:$PORT/manifest/quote.txt
+curl -s -S -H "Host: list.test" -D downloaded_files/listing.headers \
+     http://localhost:$PORT/files -o downloaded_files/listing.json
+sed 's/"mtime":[0-9]*/"mtime":N/' downloaded_files/listing.json
+grep -i "^Cache-Control" downloaded_files/listing.headers | tr -d '\r'
+curl -s -o /dev/null -w "quote.txt: %{http_code}\n" http://localhost:$PORT/quote.txt
+
+echo "Sending SIGINT to trigger server shutdown"
+kill -INT $http_server_pid
+wait $http_server_pid
+echo "Server has terminated"
@@ -0,0 +1,52 @@
+#! /bin/bash
+
+# Limits are low enough that no token refills while the test runs
+echo "Starting Server with a connection limit"
+./http_server -l 0.01:3 server_files $PORT &
+http_server_pid=$!
+sleep 0.2
+
+for i in 1 2 3 4 5
+do
+    curl -s -o /dev/null -w "connection $i: %{http_code}\n" http://localhost:$PORT/quote.txt
+done
+kill -USR1 $http_server_pid
+sleep 0.2
+
+echo "Sending SIGINT to trigger server shutdown"
+kill -INT $http_server_pid
+wait $http_server_pid
+echo "Server has terminated"
+
+echo "Starting Server with a request limit"
+./http_server -L 0.01:2 server_files $PORT &
+http_server_pid=$!
+sleep 0.2
+
+for i in 1 2 3 4
+do
+    curl -s -o /dev/null -w "request $i: %{http_code}\n" http://localhost:$PORT/quote.txt
+done
+
+# Stats are still reported for a SIGUSR1 that arrives while every worker is
+# busy and the queue is full, once there is room again
+idle_fds=()
+for i in $(seq 12)
+do
+    exec {fd}<> /dev/tcp/localhost/$PORT
+    idle_fds+=($fd)
+done
+sleep 0.2
+kill -USR1 $http_server_pid
+sleep 0.2
+echo "Closing idle connections"
+for fd in ${idle_fds[@]}
+do
+    exec {fd}>&-
+done
+sleep 0.2
+
+echo "Sending SIGINT to trigger server shutdown"
+kill -INT $http_server_pid
+wait $http_server_pid
+echo "Server has terminated"
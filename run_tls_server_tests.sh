@@ -0,0 +1,38 @@
+#! /bin/bash
+
+target_files=(
+    "quote.txt"
+    "index.html"
+    "gatsby.txt"
+    "ocelot.jpg"
+)
+
+rm -rf downloaded_files
+mkdir -p downloaded_files
+echo "Starting HTTPS Server"
+./http_server -C test_certs/cert.pem -K test_certs/key.pem server_files $PORT &
+http_server_pid=$!
+sleep 0.2
+
+# Fetch all files from one curl process so later connections can resume the
+# TLS session established by the first one
+urls=( )
+for target_file in ${target_files[@]}
+do
+    urls+=(https://localhost:$PORT/$target_file -o downloaded_files/$target_file)
+done
+echo "Retrieving files over HTTPS"
+curl -s -S -v --insecure --http1.0 ${urls[@]} 2> downloaded_files/curl.log
+if grep -q -i "re-using session" downloaded_files/curl.log; then
+    echo "TLS session resumed"
+fi
+
+echo "Sending SIGINT to trigger server shutdown"
+kill -INT $http_server_pid
+wait $http_server_pid
+echo "Server has terminated"
+
+for target_file in ${target_files[@]}
+do
+    diff -q server_files/$target_file downloaded_files/$target_file
+done
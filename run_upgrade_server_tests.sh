@@ -0,0 +1,42 @@
+#! /bin/bash
+
+upgrade_sock=downloaded_files/upgrade.sock
+# Requests per client: a burst of 3, refilled too slowly to matter here
+server_args="-U $upgrade_sock -L 0.2:3 server_files $PORT"
+
+rm -rf downloaded_files
+mkdir -p downloaded_files
+echo "Starting Old Server"
+./http_server $server_args 2> downloaded_files/old_server.log &
+old_pid=$!
+sleep 0.2
+for i in 1 2
+do
+    curl -s -o /dev/null -w "old server: %{http_code}\n" http://localhost:$PORT/quote.txt
+done
+
+# Accepted by the old server before the upgrade, answered after it
+exec 3<> /dev/tcp/localhost/$PORT
+sleep 0.1
+echo "Starting New Server"
+./http_server $server_args &
+new_pid=$!
+sleep 0.3
+printf 'GET /gatsby.txt HTTP/1.0\r\n\r\n' >&3
+cat <&3 > downloaded_files/gatsby.response
+exec 3<&-
+head -n 1 downloaded_files/gatsby.response | tr -d '\r'
+wait $old_pid
+cat downloaded_files/old_server.log
+echo "Old server has terminated"
+
+# The new server carries on with the client's remaining request budget
+for i in 1 2
+do
+    curl -s -o /dev/null -w "new server: %{http_code}\n" http://localhost:$PORT/quote.txt
+done
+
+echo "Sending SIGINT to trigger server shutdown"
+kill -INT $new_pid
+wait $new_pid
+echo "Server has terminated"
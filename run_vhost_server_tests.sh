@@ -0,0 +1,44 @@
+#! /bin/bash
+
+rm -rf downloaded_files
+mkdir -p downloaded_files
+# The server reloads its own copy, which the test then changes
+cp test_vhosts.conf downloaded_files/vhosts.conf
+echo "Starting Virtual Host Server"
+./http_server -c downloaded_files/vhosts.conf server_files $PORT &
+http_server_pid=$!
+sleep 0.2
+
+echo "Retrieving files by host"
+curl -s -S -D downloaded_files/quote.headers http://localhost:$PORT/quote.txt \
+     -o downloaded_files/quote.txt
+diff -q server_files/quote.txt downloaded_files/quote.txt
+grep -i "^Cache-Control" downloaded_files/quote.headers | tr -d '\r'
+curl -s -S --compressed -H "Host: docs.test" -D downloaded_files/gatsby.headers \
+     http://localhost:$PORT/text/gatsby.txt -o downloaded_files/gatsby.txt
+diff -q server_files/gatsby.txt downloaded_files/gatsby.txt
+grep -i "^Content-Encoding" downloaded_files/gatsby.headers | tr -d '\r'
+curl -s -o /dev/null -w "docs.test/quote.txt: %{http_code}\n" -H "Host: docs.test" \
+     http://localhost:$PORT/quote.txt
+for i in 1 2 3
+do
+    curl -s -o /dev/null -w "docs.test/images/ocelot.jpg: %{http_code}\n" -H "Host: DOCS.test" \
+         http://localhost:$PORT/images/ocelot.jpg
+done
+
+# A connection accepted before the reload is still answered after it
+exec 3<> /dev/tcp/localhost/$PORT
+echo "Reloading configuration"
+printf 'host new.test\n    route /files dir=server_files\n' >> downloaded_files/vhosts.conf
+kill -HUP $http_server_pid
+sleep 0.2
+printf 'GET /quote.txt HTTP/1.0\r\n\r\n' >&3
+head -n 1 <&3 | tr -d '\r'
+exec 3<&-
+curl -s -o /dev/null -w "new.test/files/quote.txt: %{http_code}\n" -H "Host: new.test" \
+     http://localhost:$PORT/files/quote.txt
+
+echo "Sending SIGINT to trigger server shutdown"
+kill -INT $http_server_pid
+wait $http_server_pid
+echo "Server has terminated"
@@ -0,0 +1,123 @@
+#include <fcntl.h>
+#include <limits.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include "socket_profile.h"
+
+#define DEFAULT_BACKLOG 5
+
+void socket_profile_default(socket_profile_t *profile) {
+    memset(profile, 0, sizeof(socket_profile_t));
+    profile->backlog = DEFAULT_BACKLOG;
+    profile->reuse_addr = 1;
+    profile->accept_batch = 1;
+}
+
+int socket_profile_parse(socket_profile_t *profile, const char *spec) {
+    if (strcmp(spec, "default") == 0) {
+        return 0;
+    }
+    char copy[256];
+    if (snprintf(copy, sizeof(copy), "%s", spec) >= (int) sizeof(copy)) {
+        return -1;
+    }
+    char *save_ptr;
+    for (char *setting = strtok_r(copy, ",", &save_ptr); setting != NULL;
+         setting = strtok_r(NULL, ",", &save_ptr)) {
+        char *value = strchr(setting, '=');
+        if (value == NULL) {
+            return -1;
+        }
+        *value++ = '\0';
+        char *end;
+        long number = strtol(value, &end, 10);
+        // Every setting ends up in an int
+        if (end == value || *end != '\0' || number < 0 || number > INT_MAX) {
+            return -1;
+        }
+        if (strcmp(setting, "backlog") == 0) {
+            profile->backlog = number;
+        } else if (strcmp(setting, "reuse_addr") == 0) {
+            profile->reuse_addr = number;
+        } else if (strcmp(setting, "batch") == 0) {
+            profile->accept_batch = number > 0 ? number : 1;
+        } else if (strcmp(setting, "defer_accept") == 0) {
+            profile->defer_accept_secs = number;
+        } else if (strcmp(setting, "fastopen") == 0) {
+            profile->fastopen_qlen = number;
+        } else if (strcmp(setting, "nodelay") == 0) {
+            profile->nodelay = number;
+        } else if (strcmp(setting, "notsent_lowat") == 0) {
+            profile->notsent_lowat = number;
+        } else if (strcmp(setting, "sndbuf") == 0) {
+            profile->sndbuf = number;
+        } else if (strcmp(setting, "busy_poll") == 0) {
+            profile->busy_poll_usecs = number;
+        } else {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Sets an integer socket option, reporting failures under 'name'
+static int set_option(int fd, int level, int option, int value, const char *name) {
+    if (setsockopt(fd, level, option, &value, sizeof(value)) == -1) {
+        perror(name);
+        return -1;
+    }
+    return 0;
+}
+
+int socket_profile_apply_listener(const socket_profile_t *profile, int sock_fd) {
+    if (profile->reuse_addr
+        && set_option(sock_fd, SOL_SOCKET, SO_REUSEADDR, 1, "SO_REUSEADDR") == -1) {
+        return -1;
+    }
+    if (profile->defer_accept_secs > 0
+        && set_option(sock_fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, profile->defer_accept_secs,
+                      "TCP_DEFER_ACCEPT") == -1) {
+        return -1;
+    }
+    if (profile->fastopen_qlen > 0
+        && set_option(sock_fd, IPPROTO_TCP, TCP_FASTOPEN, profile->fastopen_qlen,
+                      "TCP_FASTOPEN") == -1) {
+        return -1;
+    }
+    // Draining the listener needs accept() to fail rather than block once
+    // there are no more pending connections
+    if (profile->accept_batch > 1) {
+        int flags = fcntl(sock_fd, F_GETFL);
+        if (flags == -1 || fcntl(sock_fd, F_SETFL, flags | O_NONBLOCK) == -1) {
+            perror("fcntl");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int socket_profile_apply_client(const socket_profile_t *profile, int client_fd) {
+    if (profile->nodelay
+        && set_option(client_fd, IPPROTO_TCP, TCP_NODELAY, 1, "TCP_NODELAY") == -1) {
+        return -1;
+    }
+    if (profile->notsent_lowat > 0
+        && set_option(client_fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, profile->notsent_lowat,
+                      "TCP_NOTSENT_LOWAT") == -1) {
+        return -1;
+    }
+    if (profile->sndbuf > 0
+        && set_option(client_fd, SOL_SOCKET, SO_SNDBUF, profile->sndbuf, "SO_SNDBUF") == -1) {
+        return -1;
+    }
+    if (profile->busy_poll_usecs > 0
+        && set_option(client_fd, SOL_SOCKET, SO_BUSY_POLL, profile->busy_poll_usecs,
+                      "SO_BUSY_POLL") == -1) {
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,46 @@
+#ifndef SOCKET_PROFILE_H
+#define SOCKET_PROFILE_H
+
+// Tunable options for the listening socket and accepted connections.
+// A value of 0 leaves the corresponding option at the kernel's default.
+typedef struct {
+    int backlog;            // listen() backlog
+    int reuse_addr;         // SO_REUSEADDR, so restarts can bind right away
+    int accept_batch;       // Connections accepted per wakeup of the listener
+    int defer_accept_secs;  // TCP_DEFER_ACCEPT: wake up only once data arrives
+    int fastopen_qlen;      // TCP_FASTOPEN: pending TFO request queue length
+    int nodelay;            // TCP_NODELAY on connections
+    int notsent_lowat;      // TCP_NOTSENT_LOWAT on connections, in bytes
+    int sndbuf;             // SO_SNDBUF on connections, in bytes
+    int busy_poll_usecs;    // SO_BUSY_POLL on connections
+} socket_profile_t;
+
+/*
+ * Fill in the default profile, which only turns on SO_REUSEADDR.
+ */
+void socket_profile_default(socket_profile_t *profile);
+
+/*
+ * Update a profile from a comma-separated list of name=value settings, e.g.
+ * "backlog=1024,batch=16,defer_accept=1,fastopen=256,nodelay=1,
+ *  notsent_lowat=16384,sndbuf=262144,busy_poll=50,reuse_addr=0".
+ * The single word "default" leaves the profile unchanged.
+ * Returns 0 on success or -1 if 'spec' is malformed or a value is negative
+ * or larger than INT_MAX
+ */
+int socket_profile_parse(socket_profile_t *profile, const char *spec);
+
+/*
+ * Apply the listener options of a profile to a socket that has not been bound
+ * yet. When accepting in batches, the socket is also made non-blocking.
+ * Returns 0 on success or -1 on error
+ */
+int socket_profile_apply_listener(const socket_profile_t *profile, int sock_fd);
+
+/*
+ * Apply the per-connection options of a profile to an accepted socket.
+ * Returns 0 on success or -1 on error
+ */
+int socket_profile_apply_client(const socket_profile_t *profile, int client_fd);
+
+#endif // SOCKET_PROFILE_H
@@ -0,0 +1,110 @@
+#include <stdio.h>
+#include <openssl/err.h>
+#include "tls.h"
+
+#define SESSION_ID_CONTEXT "http_server"
+#define SESSION_CACHE_SIZE 1024
+#define SESSION_TIMEOUT_SECS 300
+
+// Prints all errors queued by OpenSSL, prefixed by 'msg'
+static void print_tls_errors(const char *msg) {
+    unsigned long err;
+    while ((err = ERR_get_error()) != 0) {
+        char buf[256];
+        ERR_error_string_n(err, buf, sizeof(buf));
+        fprintf(stderr, "%s: %s\n", msg, buf);
+    }
+}
+
+SSL_CTX *tls_server_init(const char *cert_path, const char *key_path) {
+    SSL_CTX *ctx = SSL_CTX_new(TLS_server_method());
+    if (ctx == NULL) {
+        print_tls_errors("SSL_CTX_new");
+        return NULL;
+    }
+    if (SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION) != 1) {
+        print_tls_errors("SSL_CTX_set_min_proto_version");
+        SSL_CTX_free(ctx);
+        return NULL;
+    }
+    if (SSL_CTX_use_certificate_chain_file(ctx, cert_path) != 1) {
+        print_tls_errors("SSL_CTX_use_certificate_chain_file");
+        SSL_CTX_free(ctx);
+        return NULL;
+    }
+    if (SSL_CTX_use_PrivateKey_file(ctx, key_path, SSL_FILETYPE_PEM) != 1
+        || SSL_CTX_check_private_key(ctx) != 1) {
+        print_tls_errors("SSL_CTX_use_PrivateKey_file");
+        SSL_CTX_free(ctx);
+        return NULL;
+    }
+
+    // Prefer AES-GCM, which the kernel can take over for kTLS
+    if (SSL_CTX_set_ciphersuites(ctx, "TLS_AES_128_GCM_SHA256:TLS_AES_256_GCM_SHA384:"
+                                      "TLS_CHACHA20_POLY1305_SHA256") != 1
+        || SSL_CTX_set_cipher_list(ctx, "ECDHE+AESGCM:ECDHE+CHACHA20") != 1) {
+        print_tls_errors("SSL_CTX_set_ciphersuites");
+        SSL_CTX_free(ctx);
+        return NULL;
+    }
+    SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS | SSL_OP_CIPHER_SERVER_PREFERENCE);
+
+    // Session resumption: stateless tickets (the OpenSSL default) plus a
+    // server-side cache for TLS 1.2 clients that resume by session ID
+    if (SSL_CTX_set_session_id_context(ctx, (const unsigned char *) SESSION_ID_CONTEXT,
+                                       sizeof(SESSION_ID_CONTEXT) - 1) != 1) {
+        print_tls_errors("SSL_CTX_set_session_id_context");
+        SSL_CTX_free(ctx);
+        return NULL;
+    }
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+    SSL_CTX_sess_set_cache_size(ctx, SESSION_CACHE_SIZE);
+    SSL_CTX_set_timeout(ctx, SESSION_TIMEOUT_SECS);
+    // A single TLS 1.3 ticket per handshake is enough for a resuming client
+    SSL_CTX_set_num_tickets(ctx, 1);
+
+    return ctx;
+}
+
+SSL *tls_accept(SSL_CTX *ctx, int client_fd) {
+    SSL *ssl = SSL_new(ctx);
+    if (ssl == NULL) {
+        print_tls_errors("SSL_new");
+        return NULL;
+    }
+    if (SSL_set_fd(ssl, client_fd) != 1) {
+        print_tls_errors("SSL_set_fd");
+        SSL_free(ssl);
+        return NULL;
+    }
+    if (SSL_accept(ssl) != 1) {
+        print_tls_errors("SSL_accept");
+        SSL_free(ssl);
+        return NULL;
+    }
+    return ssl;
+}
+
+int tls_ktls_send_enabled(SSL *ssl) {
+    return BIO_get_ktls_send(SSL_get_wbio(ssl));
+}
+
+int tls_get_ticket_keys(SSL_CTX *ctx, unsigned char keys[TLS_TICKET_KEYS_LEN]) {
+    if (SSL_CTX_get_tlsext_ticket_keys(ctx, keys, TLS_TICKET_KEYS_LEN) != 1) {
+        print_tls_errors("SSL_CTX_get_tlsext_ticket_keys");
+        return -1;
+    }
+    return 0;
+}
+
+int tls_set_ticket_keys(SSL_CTX *ctx, const unsigned char keys[TLS_TICKET_KEYS_LEN]) {
+    if (SSL_CTX_set_tlsext_ticket_keys(ctx, (unsigned char *) keys, TLS_TICKET_KEYS_LEN) != 1) {
+        print_tls_errors("SSL_CTX_set_tlsext_ticket_keys");
+        return -1;
+    }
+    return 0;
+}
+
+void tls_server_free(SSL_CTX *ctx) {
+    SSL_CTX_free(ctx);
+}
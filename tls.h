@@ -0,0 +1,48 @@
+#ifndef TLS_H
+#define TLS_H
+
+#include <openssl/ssl.h>
+
+// Size of the key material that encrypts session tickets
+#define TLS_TICKET_KEYS_LEN 80
+
+/*
+ * Create a TLS server context for HTTPS listeners.
+ * Session tickets are enabled so that returning clients can resume their
+ * session with an abbreviated handshake, and kernel TLS (kTLS) offload is
+ * requested so that, once the handshake is done, record encryption happens in
+ * the kernel and file bodies can be sent with sendfile().
+ * cert_path: Path to a PEM certificate (chain)
+ * key_path: Path to the PEM private key for the certificate
+ * Returns the new context on success or NULL on error
+ */
+SSL_CTX *tls_server_init(const char *cert_path, const char *key_path);
+
+/*
+ * Perform the server side of the TLS handshake on an accepted socket.
+ * ctx: The context returned by tls_server_init()
+ * client_fd: The socket file descriptor of the connection
+ * Returns the established session on success or NULL on error
+ */
+SSL *tls_accept(SSL_CTX *ctx, int client_fd);
+
+/*
+ * Returns true if encryption of data sent on 'ssl' has been offloaded to the
+ * kernel, in which case SSL_sendfile() does not copy through user space.
+ */
+int tls_ktls_send_enabled(SSL *ssl);
+
+/*
+ * Copy out the keys session tickets are encrypted with, or replace them, so
+ * that a server taking over from this one can resume sessions it issued.
+ * Returns 0 on success or -1 on error
+ */
+int tls_get_ticket_keys(SSL_CTX *ctx, unsigned char keys[TLS_TICKET_KEYS_LEN]);
+int tls_set_ticket_keys(SSL_CTX *ctx, const unsigned char keys[TLS_TICKET_KEYS_LEN]);
+
+/*
+ * Free a context returned by tls_server_init().
+ */
+void tls_server_free(SSL_CTX *ctx);
+
+#endif // TLS_H
@@ -0,0 +1,127 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include "trace.h"
+
+int trace_sampler_enabled = 0;
+
+static FILE *trace_file = NULL;
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned int trace_sample_every = 1;
+static uint64_t next_request_id = 0;
+static __thread request_trace_t *current_trace = NULL;
+static __thread long thread_id = 0;
+
+#ifdef HAVE_SYS_SDT_H
+#define TRACE_DEFINE_SEMAPHORE(phase) \
+    __extension__ unsigned short http_server_##phase##_semaphore \
+    __attribute__((unused)) __attribute__((section(".probes")));
+TRACE_PHASES(TRACE_DEFINE_SEMAPHORE)
+#endif
+
+int trace_open(const char *path, unsigned int sample_every) {
+    trace_file = fopen(path, "w");
+    if (trace_file == NULL) {
+        perror("fopen");
+        return -1;
+    }
+    // The JSON array format lets the closing bracket be left off if we crash
+    fprintf(trace_file, "[\n");
+    trace_sample_every = sample_every > 0 ? sample_every : 1;
+    trace_sampler_enabled = 1;
+    return 0;
+}
+
+int trace_open_spec(const char *spec) {
+    char path[256];
+    unsigned int sample_every = 1;
+    if (snprintf(path, sizeof(path), "%s", spec) >= (int) sizeof(path)) {
+        return -1;
+    }
+    char *colon = strrchr(path, ':');
+    if (colon != NULL) {
+        char *end;
+        sample_every = strtoul(colon + 1, &end, 10);
+        if (end == colon + 1 || *end != '\0' || sample_every == 0) {
+            return -1;
+        }
+        *colon = '\0';
+    }
+    return trace_open(path, sample_every);
+}
+
+void trace_close(void) {
+    if (trace_file == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&trace_lock);
+    trace_sampler_enabled = 0;
+    fprintf(trace_file, "{}]\n");
+    if (fclose(trace_file) == EOF) {
+        perror("fclose");
+    }
+    trace_file = NULL;
+    pthread_mutex_unlock(&trace_lock);
+}
+
+int trace_usdt_attached(void) {
+#ifdef HAVE_SYS_SDT_H
+#define TRACE_SEMAPHORE_SET(phase) http_server_##phase##_semaphore != 0 ||
+    return TRACE_PHASES(TRACE_SEMAPHORE_SET) 0;
+#else
+    return 0;
+#endif
+}
+
+uint64_t trace_now_ns(void) {
+    if (!trace_sampler_enabled && !trace_usdt_attached()) {
+        return 0;
+    }
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void trace_request_begin(request_trace_t *trace, uint64_t queued_ns) {
+    trace->id = __atomic_add_fetch(&next_request_id, 1, __ATOMIC_RELAXED);
+    trace->sampled = trace_sampler_enabled && trace->id % trace_sample_every == 0;
+    trace->timed = trace->sampled || trace_usdt_attached();
+    if (!trace->timed) {
+        return;
+    }
+    uint64_t now_ns = trace_now_ns();
+    trace->last_ns = queued_ns != 0 ? queued_ns : now_ns;
+    TRACE_USDT(queue_wait, trace->id, trace->last_ns, now_ns);
+    trace_record(trace, "queue_wait", now_ns);
+}
+
+void trace_record(request_trace_t *trace, const char *phase, uint64_t end_ns) {
+    uint64_t start_ns = trace->last_ns;
+    trace->last_ns = end_ns;
+    if (!trace->sampled || trace_file == NULL) {
+        return;
+    }
+    if (thread_id == 0) {
+        thread_id = syscall(SYS_gettid);
+    }
+    pthread_mutex_lock(&trace_lock);
+    if (trace_file != NULL) {
+        fprintf(trace_file, "{\"name\":\"%s\",\"cat\":\"http\",\"ph\":\"X\",\"ts\":%.3f,"
+                "\"dur\":%.3f,\"pid\":%d,\"tid\":%ld,\"args\":{\"request\":%llu}},\n",
+                phase, start_ns / 1e3, (end_ns - start_ns) / 1e3, (int) getpid(), thread_id,
+                (unsigned long long) trace->id);
+    }
+    pthread_mutex_unlock(&trace_lock);
+}
+
+void trace_set_current(request_trace_t *trace) {
+    current_trace = trace;
+}
+
+request_trace_t *trace_current(void) {
+    return current_trace;
+}
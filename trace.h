@@ -0,0 +1,99 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+/*
+ * Per-request phase tracing. Every phase boundary of a request is marked with
+ * TRACE_PHASE(), which:
+ *  - fires the USDT probe http_server:<phase>(request id, start ns, end ns)
+ *    when built with <sys/sdt.h> (HAVE_SYS_SDT_H). Probes are a single nop
+ *    until a tracer such as bpftrace or SystemTap attaches to them.
+ *  - for requests sampled by the in-process tracer (see trace_open()), appends
+ *    a Chrome trace_event "complete" event to the trace file.
+ * Timestamps come from CLOCK_MONOTONIC and are only taken for requests that
+ * are sampled or that began while a tracer was attached to a probe.
+ */
+
+// Every phase marked with TRACE_PHASE(). A new phase has to be added here.
+#define TRACE_PHASES(X) X(queue_wait) X(tls_handshake) X(request_recv) \
+    X(request_parse) X(open) X(disk_offload) X(stat) X(send_headers) \
+    X(send_body) X(send_error) X(handler) X(close)
+
+#ifdef HAVE_SYS_SDT_H
+// Each probe gets a semaphore that tracers increment while attached to it
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+#define TRACE_DECLARE_SEMAPHORE(phase) extern unsigned short http_server_##phase##_semaphore;
+TRACE_PHASES(TRACE_DECLARE_SEMAPHORE)
+#define TRACE_USDT(phase, id, start_ns, end_ns) \
+    DTRACE_PROBE3(http_server, phase, id, start_ns, end_ns)
+#else
+#define TRACE_USDT(phase, id, start_ns, end_ns) do { } while (0)
+#endif
+
+// Tracing state of one request, carried along with its connection
+typedef struct {
+    uint64_t id;
+    uint64_t last_ns;   // End of the previous phase
+    int sampled;        // Recorded by the in-process tracer
+    int timed;          // Phase timestamps are taken
+} request_trace_t;
+
+extern int trace_sampler_enabled;
+
+// Ends the current phase of 'trace', named 'phase', and starts the next one
+#define TRACE_PHASE(trace, phase) do { \
+    request_trace_t *trace_ = (trace); \
+    if (trace_ != NULL && trace_->timed) { \
+        uint64_t trace_end_ns_ = trace_now_ns(); \
+        TRACE_USDT(phase, trace_->id, trace_->last_ns, trace_end_ns_); \
+        trace_record(trace_, #phase, trace_end_ns_); \
+    } \
+} while (0)
+
+/*
+ * Start writing sampled requests to 'path' in Chrome trace_event JSON format,
+ * which can be loaded into chrome://tracing or Perfetto.
+ * sample_every: Record one in every 'sample_every' requests
+ * Returns 0 on success or -1 on error
+ */
+int trace_open(const char *path, unsigned int sample_every);
+
+/*
+ * Parse "<path>[:<sample_every>]" and call trace_open().
+ * Returns 0 on success or -1 on error
+ */
+int trace_open_spec(const char *spec);
+
+/*
+ * Flush and close the trace file, if any.
+ */
+void trace_close(void);
+
+// Returns true if a tracer is attached to any of the USDT probes
+int trace_usdt_attached(void);
+
+// Returns a CLOCK_MONOTONIC timestamp, or 0 when no tracing is active at all
+uint64_t trace_now_ns(void);
+
+/*
+ * Begin tracing a request that has been waiting since 'queued_ns' (0 if
+ * unknown): assigns it an id, decides whether it is sampled and records the
+ * time it spent queued as the phase 'queue_wait'.
+ */
+void trace_request_begin(request_trace_t *trace, uint64_t queued_ns);
+
+/*
+ * Record the phase of 'trace' ending at 'end_ns'. Use TRACE_PHASE() instead.
+ */
+void trace_record(request_trace_t *trace, const char *phase, uint64_t end_ns);
+
+/*
+ * Set/get the trace of the request the calling thread is working on, so that
+ * code deeper in the call stack can mark phases with TRACE_PHASE(trace_current(), ...).
+ */
+void trace_set_current(request_trace_t *trace);
+request_trace_t *trace_current(void);
+
+#endif // TRACE_H
@@ -0,0 +1,262 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "upgrade.h"
+
+#define UPGRADE_MAGIC 0x48535550    // "HSUP"
+// Neither side waits longer than this for the other
+#define UPGRADE_TIMEOUT_SECS 10
+// Far more than the rate limiters and ticket keys can add up to
+#define UPGRADE_MAX_STATE_LEN (64 << 20)
+
+// Sent ahead of the state snapshot, together with the descriptors
+typedef struct {
+    uint32_t magic;
+    uint32_t n_fds;
+    uint64_t state_len;
+} upgrade_header_t;
+
+// Fills in the address of the Unix socket at 'path'
+// Returns 0 on success or -1 if the path is too long
+static int unix_address(const char *path, struct sockaddr_un *addr) {
+    memset(addr, 0, sizeof(struct sockaddr_un));
+    addr->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr->sun_path)) {
+        fprintf(stderr, "upgrade socket path too long: %s\n", path);
+        return -1;
+    }
+    strcpy(addr->sun_path, path);
+    return 0;
+}
+
+// Bounds how long reads and writes on 'fd' can block
+static int set_timeouts(int fd) {
+    struct timeval timeout = { UPGRADE_TIMEOUT_SECS, 0 };
+    if (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) == -1
+        || setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)) == -1) {
+        perror("setsockopt");
+        return -1;
+    }
+    return 0;
+}
+
+// Checks that the process at the other end of 'fd' runs as the same user
+// Returns 0 if it does or -1 otherwise
+static int check_peer(int fd) {
+    struct ucred peer;
+    socklen_t peer_len = sizeof(peer);
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &peer, &peer_len) == -1) {
+        perror("SO_PEERCRED");
+        return -1;
+    }
+    if (peer.uid != geteuid()) {
+        fprintf(stderr, "refusing upgrade with uid %d\n", (int) peer.uid);
+        return -1;
+    }
+    return 0;
+}
+
+int upgrade_listen(const char *path) {
+    struct sockaddr_un addr;
+    if (unix_address(path, &addr) == -1) {
+        return -1;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        perror("socket");
+        return -1;
+    }
+    // A server that exits without being upgraded leaves its socket file behind
+    if (unlink(path) == -1 && errno != ENOENT) {
+        perror(path);
+        close(fd);
+        return -1;
+    }
+    // The snapshot holds secrets, so only the server's user may connect
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) == -1
+        || chmod(path, S_IRUSR | S_IWUSR) == -1 || listen(fd, 1) == -1) {
+        perror(path);
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int upgrade_send(int control_fd, const int *fds, int n_fds, const void *state, size_t state_len) {
+    if (n_fds > UPGRADE_MAX_FDS) {
+        return -1;
+    }
+    if (check_peer(control_fd) == -1 || set_timeouts(control_fd) == -1) {
+        return -1;
+    }
+
+    // The descriptors travel as ancillary data of the header
+    upgrade_header_t header = { UPGRADE_MAGIC, n_fds, state_len };
+    struct iovec iov = { &header, sizeof(header) };
+    union {
+        char buf[CMSG_SPACE(sizeof(int) * UPGRADE_MAX_FDS)];
+        struct cmsghdr align;
+    } control;
+    memset(&control, 0, sizeof(control));
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if (n_fds > 0) {
+        msg.msg_control = control.buf;
+        msg.msg_controllen = CMSG_SPACE(sizeof(int) * n_fds);
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int) * n_fds);
+        memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * n_fds);
+    }
+    if (sendmsg(control_fd, &msg, MSG_NOSIGNAL) != sizeof(header)) {
+        perror("sendmsg");
+        return -1;
+    }
+
+    const char *pos = state;
+    while (state_len > 0) {
+        ssize_t bytes_sent = send(control_fd, pos, state_len, MSG_NOSIGNAL);
+        if (bytes_sent == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("send");
+            return -1;
+        }
+        pos += bytes_sent;
+        state_len -= bytes_sent;
+    }
+    return 0;
+}
+
+int upgrade_confirmed(int control_fd) {
+    char ready;
+    ssize_t bytes_read;
+    while ((bytes_read = read(control_fd, &ready, 1)) == -1 && errno == EINTR) {
+    }
+    return bytes_read == 1;
+}
+
+// Closes the descriptors received so far and the connection to the old server
+static void abort_handoff(upgrade_handoff_t *handoff) {
+    for (int i = 0; i < handoff->n_fds; i++) {
+        close(handoff->fds[i]);
+    }
+    handoff->n_fds = 0;
+    free(handoff->state);
+    handoff->state = NULL;
+    close(handoff->control_fd);
+    handoff->control_fd = -1;
+}
+
+int upgrade_receive(const char *path, upgrade_handoff_t *handoff) {
+    memset(handoff, 0, sizeof(upgrade_handoff_t));
+    struct sockaddr_un addr;
+    if (unix_address(path, &addr) == -1) {
+        return -1;
+    }
+    if ((handoff->control_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) == -1) {
+        perror("socket");
+        return -1;
+    }
+    if (connect(handoff->control_fd, (struct sockaddr *) &addr, sizeof(addr)) == -1) {
+        // Nothing to take over: no socket file, or one left by a server that
+        // is gone
+        int none = errno == ENOENT || errno == ECONNREFUSED;
+        if (!none) {
+            perror(path);
+        }
+        close(handoff->control_fd);
+        handoff->control_fd = -1;
+        return none ? 0 : -1;
+    }
+    // Whoever holds the socket hands over its listeners and state, so it must
+    // be one of our own servers
+    if (check_peer(handoff->control_fd) == -1 || set_timeouts(handoff->control_fd) == -1) {
+        abort_handoff(handoff);
+        return -1;
+    }
+
+    upgrade_header_t header;
+    struct iovec iov = { &header, sizeof(header) };
+    union {
+        char buf[CMSG_SPACE(sizeof(int) * UPGRADE_MAX_FDS)];
+        struct cmsghdr align;
+    } control;
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    ssize_t bytes_read;
+    while ((bytes_read = recvmsg(handoff->control_fd, &msg, MSG_CMSG_CLOEXEC)) == -1
+           && errno == EINTR) {
+    }
+    // Take ownership of whatever descriptors arrived before checking the rest
+    for (struct cmsghdr *cmsg = bytes_read > 0 ? CMSG_FIRSTHDR(&msg) : NULL; cmsg != NULL;
+         cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+            int n_fds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            memcpy(handoff->fds, CMSG_DATA(cmsg), sizeof(int) * n_fds);
+            handoff->n_fds = n_fds;
+        }
+    }
+    if (bytes_read != sizeof(header) || header.magic != UPGRADE_MAGIC
+        || header.n_fds != handoff->n_fds || (msg.msg_flags & MSG_CTRUNC)
+        || header.state_len > UPGRADE_MAX_STATE_LEN) {
+        fprintf(stderr, "invalid upgrade handoff from %s\n", path);
+        abort_handoff(handoff);
+        return -1;
+    }
+
+    handoff->state_len = header.state_len;
+    if ((handoff->state = malloc(header.state_len + 1)) == NULL) {
+        perror("malloc");
+        abort_handoff(handoff);
+        return -1;
+    }
+    size_t received = 0;
+    while (received < handoff->state_len) {
+        bytes_read = read(handoff->control_fd, handoff->state + received,
+                          handoff->state_len - received);
+        if (bytes_read <= 0) {
+            if (bytes_read == -1 && errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "upgrade state snapshot truncated\n");
+            abort_handoff(handoff);
+            return -1;
+        }
+        received += bytes_read;
+    }
+    return 1;
+}
+
+int upgrade_ready(upgrade_handoff_t *handoff) {
+    free(handoff->state);
+    handoff->state = NULL;
+    int result = 0;
+    if (send(handoff->control_fd, "R", 1, MSG_NOSIGNAL) != 1) {
+        perror("send");
+        result = -1;
+    }
+    if (close(handoff->control_fd) == -1) {
+        perror("close");
+        result = -1;
+    }
+    handoff->control_fd = -1;
+    return result;
+}
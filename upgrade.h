@@ -0,0 +1,55 @@
+#ifndef UPGRADE_H
+#define UPGRADE_H
+
+#include <stddef.h>
+
+#define UPGRADE_MAX_FDS 8
+
+// What a new server receives from the one it replaces
+typedef struct {
+    int control_fd;                 // Connection to the old server
+    int fds[UPGRADE_MAX_FDS];       // Its listening sockets
+    int n_fds;
+    char *state;                    // Snapshot of its warm state
+    size_t state_len;
+} upgrade_handoff_t;
+
+/*
+ * Listen for upgrade requests from new servers on the Unix socket at 'path',
+ * replacing a socket file a previous server may have left behind.
+ * Returns the listening socket or -1 on error
+ */
+int upgrade_listen(const char *path);
+
+/*
+ * Old server: hand the listening sockets 'fds' and a snapshot of warm state to
+ * the new server on 'control_fd', accepted from the socket returned by
+ * upgrade_listen(). The old server keeps accepting until the new one calls
+ * upgrade_ready().
+ * Returns 0 on success or -1 on error
+ */
+int upgrade_send(int control_fd, const int *fds, int n_fds, const void *state, size_t state_len);
+
+/*
+ * Old server: read the new server's answer once 'control_fd' is readable.
+ * Returns 1 if the new server is accepting connections, or 0 if it went away
+ * without getting that far and the old server should carry on
+ */
+int upgrade_confirmed(int control_fd);
+
+/*
+ * New server: take over the listening sockets of the server listening for
+ * upgrades at 'path', if there is one.
+ * handoff: Filled in with what the old server sent
+ * Returns 1 on success, 0 if no server is listening at 'path' or -1 on error
+ */
+int upgrade_receive(const char *path, upgrade_handoff_t *handoff);
+
+/*
+ * New server: tell the old server that connections are being accepted, so it
+ * can stop accepting and drain, and release the rest of 'handoff'.
+ * Returns 0 on success or -1 on error
+ */
+int upgrade_ready(upgrade_handoff_t *handoff);
+
+#endif // UPGRADE_H